@@ -1,9 +1,16 @@
 #include <QMetaObject>
 #include <QMetaClassInfo>
+#include <QSet>
+#include <QStringList>
+#include <QThread>
+#include <QReadLocker>
+#include <QWriteLocker>
 #include <QDebug>
 
 #include "qjsonrpcservice_p.h"
 #include "qjsonrpcservice.h"
+#include "qjsonrpcmessage_p.h"
+#include "qjsonrpcsocket_p.h"
 #include "qjsonrpcsocket.h"
 #include "qjsonrpcabstractserver_p.h"
 #include "qjsonrpcabstractserver.h"
@@ -15,6 +22,12 @@ QJsonRpcServiceProvider::QJsonRpcServiceProvider()
 
 QJsonRpcServiceProvider::~QJsonRpcServiceProvider()
 {
+    // the services owned here are deleted right after, and the others may be
+    // children of the server: finish their pooled requests while they're intact
+    foreach (const QPointer<QJsonRpcService> &service, d->liveServices) {
+        if (service)
+            service.data()->waitForInvocations();
+    }
 }
 
 QByteArray QJsonRpcServiceProviderPrivate::serviceName(QJsonRpcService *service)
@@ -29,6 +42,31 @@ QByteArray QJsonRpcServiceProviderPrivate::serviceName(QJsonRpcService *service)
     return QByteArray(mo->className()).toLower();
 }
 
+void QJsonRpcServiceProviderPrivate::addRoutes(const QByteArray &serviceName,
+                                               QJsonRpcService *service)
+{
+    QJsonRpcServicePrivate *servicePrivate = service->d_func();
+    QList<QByteArray> methods = servicePrivate->invokableMethodHash.keys();
+    methods += servicePrivate->registeredMethods.keys();
+    foreach (const QByteArray &method, methods) {
+        Route route;
+        route.service = service;
+        route.method = method;
+        routes.insert(QString::fromLatin1(serviceName + '.' + method), route);
+    }
+}
+
+void QJsonRpcServiceProviderPrivate::removeRoutes(QJsonRpcService *service)
+{
+    QHash<QString, Route>::iterator it = routes.begin();
+    while (it != routes.end()) {
+        if (it.value().service == service)
+            it = routes.erase(it);
+        else
+            ++it;
+    }
+}
+
 bool QJsonRpcServiceProvider::addService(QJsonRpcService *service)
 {
     QByteArray serviceName = d->serviceName(service);
@@ -37,6 +75,7 @@ bool QJsonRpcServiceProvider::addService(QJsonRpcService *service)
         return false;
     }
 
+    QWriteLocker locker(&d->lock);
     if (d->services.contains(serviceName)) {
         qDebug() << Q_FUNC_INFO << "service with name " << serviceName << " already exist";
         return false;
@@ -44,6 +83,8 @@ bool QJsonRpcServiceProvider::addService(QJsonRpcService *service)
 
     service->d_func()->cacheInvokableInfo();
     d->services.insert(serviceName, service);
+    d->liveServices.append(service);
+    d->addRoutes(serviceName, service);
     if (!service->parent())
         d->cleanupHandler.add(service);
     return true;
@@ -52,36 +93,76 @@ bool QJsonRpcServiceProvider::addService(QJsonRpcService *service)
 bool QJsonRpcServiceProvider::removeService(QJsonRpcService *service)
 {
     QByteArray serviceName = d->serviceName(service);
+    QWriteLocker locker(&d->lock);
     if (!d->services.contains(serviceName)) {
         qDebug() << Q_FUNC_INFO << "can nof find service with name " << serviceName;
         return false;
     }
 
-    d->cleanupHandler.remove(d->services.value(serviceName));
-    d->services.remove(serviceName);
+    QJsonRpcService *removed = d->services.take(serviceName);
+    d->removeRoutes(removed);
+    d->cleanupHandler.remove(removed);
+    d->liveServices.removeAll(removed);
+    locker.unlock();
+
+    // no new requests reach it now, let the pooled ones finish before the
+    // caller gets a chance to delete it
+    removed->waitForInvocations();
     return true;
 }
 
+int QJsonRpcServiceProvider::requestTimeout() const
+{
+    QReadLocker locker(&d->lock);
+    return d->requestTimeout;
+}
+
+void QJsonRpcServiceProvider::setRequestTimeout(int msecs)
+{
+    QWriteLocker locker(&d->lock);
+    d->requestTimeout = qMax(-1, msecs);
+}
+
 void QJsonRpcServiceProvider::processMessage(QJsonRpcSocket *socket, const QJsonRpcMessage &message)
 {
     switch (message.type()) {
         case QJsonRpcMessage::Request:
         case QJsonRpcMessage::Notification: {
-            QByteArray serviceName = message.method().section(".", 0, -2).toLatin1();
-            if (serviceName.isEmpty() || !d->services.contains(serviceName)) {
-                if (message.type() == QJsonRpcMessage::Request) {
-                    QJsonRpcMessage error =
-                        message.createErrorResponse(QJsonRpc::MethodNotFound,
-                            QString("service '%1' not found").arg(serviceName.constData()));
-                    socket->notify(error);
+            QJsonRpcService *service = 0;
+            QByteArray method;
+            QReadLocker locker(&d->lock);
+            QHash<QString, QJsonRpcServiceProviderPrivate::Route>::const_iterator route =
+                d->routes.constFind(message.method());
+            if (route != d->routes.constEnd()) {
+                service = route.value().service;
+                method = route.value().method;
+            } else {
+                // not a known method, its service reports that if there is one
+                QByteArray serviceName = message.method().section(".", 0, -2).toLatin1();
+                service = d->services.value(serviceName);
+                if (!service) {
+                    locker.unlock();
+                    if (message.type() == QJsonRpcMessage::Request) {
+                        QJsonRpcMessage error =
+                            message.createErrorResponse(QJsonRpc::MethodNotFound,
+                                QString("service '%1' not found").arg(serviceName.constData()));
+                        socket->notify(error);
+                    }
+                    break;
                 }
+            }
+
+            QJsonRpcServicePrivate *servicePrivate = service->d_func();
+            QJsonRpcServiceRequest request(message, socket, method);
+            request.setDeadline(d->requestTimeout);
+            if (servicePrivate->threadPool) {
+                // still locked, so removeService() also waits for this one
+                servicePrivate->startInvocation(request);
+            } else if (service->thread() != QThread::currentThread()) {
+                servicePrivate->queueRequest(request);   // never call into a foreign thread
             } else {
-                QJsonRpcService *service = d->services.value(serviceName);
-                service->d_func()->socket = socket;
-                if (message.type() == QJsonRpcMessage::Request)
-                    QObject::connect(service, SIGNAL(result(QJsonRpcMessage)),
-                                      socket, SLOT(notify(QJsonRpcMessage)));
-                service->dispatch(message);
+                locker.unlock();
+                servicePrivate->processRequest(request);
             }
         }
         break;
@@ -121,6 +202,10 @@ bool QJsonRpcAbstractServer::addService(QJsonRpcService *service)
                this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
     connect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
                this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    connect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+               this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
+    connect(service, SIGNAL(notifySubscribers(QString,QString,QJsonArray)),
+               this, SLOT(notifySubscribers(QString,QString,QJsonArray)));
     return true;
 }
 
@@ -133,6 +218,10 @@ bool QJsonRpcAbstractServer::removeService(QJsonRpcService *service)
                   this, SLOT(notifyConnectedClients(QJsonRpcMessage)));
     disconnect(service, SIGNAL(notifyConnectedClients(QString,QJsonArray)),
                   this, SLOT(notifyConnectedClients(QString,QJsonArray)));
+    disconnect(service, SIGNAL(notifySubscribers(QString,QJsonRpcMessage)),
+                  this, SLOT(notifySubscribers(QString,QJsonRpcMessage)));
+    disconnect(service, SIGNAL(notifySubscribers(QString,QString,QJsonArray)),
+                  this, SLOT(notifySubscribers(QString,QString,QJsonArray)));
     return true;
 }
 
@@ -150,6 +239,78 @@ void QJsonRpcAbstractServer::setWireFormat(QJsonDocument::JsonFormat format)
 }
 #endif
 
+QJsonRpc::Framing QJsonRpcAbstractServer::framing() const
+{
+    Q_D(const QJsonRpcAbstractServer);
+    return d->framing;
+}
+
+void QJsonRpcAbstractServer::setFraming(QJsonRpc::Framing framing)
+{
+    Q_D(QJsonRpcAbstractServer);
+    d->framing = framing;
+}
+
+QJsonRpc::Encoding QJsonRpcAbstractServer::encoding() const
+{
+    Q_D(const QJsonRpcAbstractServer);
+    return d->encoding;
+}
+
+void QJsonRpcAbstractServer::setEncoding(QJsonRpc::Encoding encoding)
+{
+    Q_D(QJsonRpcAbstractServer);
+    d->encoding = QJsonRpcSocketPrivate::supportedEncoding(encoding);
+}
+
+bool QJsonRpcAbstractServer::isLazyParsingEnabled() const
+{
+    Q_D(const QJsonRpcAbstractServer);
+    return d->lazyParsing;
+}
+
+void QJsonRpcAbstractServer::setLazyParsingEnabled(bool enabled)
+{
+    Q_D(QJsonRpcAbstractServer);
+    d->lazyParsing = enabled;
+}
+
+qint64 QJsonRpcAbstractServer::highWaterMark() const
+{
+    Q_D(const QJsonRpcAbstractServer);
+    return d->highWaterMark;
+}
+
+void QJsonRpcAbstractServer::setHighWaterMark(qint64 bytes)
+{
+    Q_D(QJsonRpcAbstractServer);
+    d->highWaterMark = bytes;
+}
+
+qint64 QJsonRpcAbstractServer::lowWaterMark() const
+{
+    Q_D(const QJsonRpcAbstractServer);
+    return d->lowWaterMark;
+}
+
+void QJsonRpcAbstractServer::setLowWaterMark(qint64 bytes)
+{
+    Q_D(QJsonRpcAbstractServer);
+    d->lowWaterMark = bytes;
+}
+
+QJsonRpcAbstractServer::SlowClientPolicy QJsonRpcAbstractServer::slowClientPolicy() const
+{
+    Q_D(const QJsonRpcAbstractServer);
+    return d->slowClientPolicy;
+}
+
+void QJsonRpcAbstractServer::setSlowClientPolicy(SlowClientPolicy policy)
+{
+    Q_D(QJsonRpcAbstractServer);
+    d->slowClientPolicy = policy;
+}
+
 void QJsonRpcAbstractServer::notifyConnectedClients(const QString &method,
                                                     const QJsonArray &params)
 {
@@ -161,8 +322,66 @@ void QJsonRpcAbstractServer::notifyConnectedClients(const QString &method,
 void QJsonRpcAbstractServer::notifyConnectedClients(const QJsonRpcMessage &message)
 {
     Q_D(QJsonRpcAbstractServer);
-    for (int i = 0; i < d->clients.size(); ++i)
-        d->clients[i]->notify(message);
+    notifyClients(d->clients, message);
+}
+
+void QJsonRpcAbstractServer::notifySubscribers(const QString &topic, const QString &method,
+                                               const QJsonArray &params)
+{
+    QJsonRpcMessage notification =
+        QJsonRpcMessage::createNotification(method, params);
+    notifySubscribers(topic, notification);
+}
+
+void QJsonRpcAbstractServer::notifySubscribers(const QString &topic, const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcAbstractServer);
+    QHash<QString, QSet<QJsonRpcSocket*> >::const_iterator it = d->subscribers.constFind(topic);
+    if (it == d->subscribers.constEnd())
+        return;
+
+    // copied by hand, QSet::toList() is deprecated since Qt 5.14
+    QList<QJsonRpcSocket*> clients;
+    clients.reserve(it.value().size());
+    foreach (QJsonRpcSocket *client, it.value())
+        clients.append(client);
+    notifyClients(clients, message);
+}
+
+void QJsonRpcAbstractServer::notifyClients(const QList<QJsonRpcSocket*> &clients,
+                                           const QJsonRpcMessage &message)
+{
+    Q_D(QJsonRpcAbstractServer);
+
+    // serialize once per distinct client encoding, not once per client
+    QJsonRpcMessage broadcast(message);
+    QJsonDocument document(message.toObject());
+    QSet<int> encodedKeys;
+
+    // clients is a copy, disconnecting a client modifies the server's list
+    for (int i = 0; i < clients.size(); ++i) {
+        QJsonRpcSocket *client = clients.at(i);
+        if (client->isCongested()) {
+            if (d->slowClientPolicy == DropMessages)
+                continue;
+
+            if (d->slowClientPolicy == DisconnectClient) {
+                QMetaObject::invokeMethod(client, "_q_abortDevice",
+                                          QJsonRpcAbstractServerPrivate::connectionType(client));
+                continue;
+            }
+        }
+
+        // clients may live in a worker thread, only their published state is read
+        const int key = QJsonRpcSocketPrivate::get(client)->sharedEncodingKey();
+        if (!encodedKeys.contains(key)) {
+            QJsonRpcMessagePrivate::setEncodedPayload(broadcast, key,
+                                                      QJsonRpcSocketPrivate::encode(document, key));
+            encodedKeys.insert(key);
+        }
+
+        QJsonRpcAbstractServerPrivate::notifyClient(client, broadcast);
+    }
 }
 
 void QJsonRpcAbstractServerPrivate::_q_processMessage(const QJsonRpcMessage &message)
@@ -174,7 +393,98 @@ void QJsonRpcAbstractServerPrivate::_q_processMessage(const QJsonRpcMessage &mes
         return;
     }
 
+    if (processSubscription(socket, message))
+        return;
+
     q->processMessage(socket, message);
 }
 
+bool QJsonRpcAbstractServerPrivate::processSubscription(QJsonRpcSocket *socket,
+                                                        const QJsonRpcMessage &message)
+{
+    if (message.type() != QJsonRpcMessage::Request &&
+        message.type() != QJsonRpcMessage::Notification)
+        return false;
+
+    const QString method = message.method();
+    const bool subscribe = (method == QLatin1String("rpc.subscribe"));
+    if (!subscribe && method != QLatin1String("rpc.unsubscribe"))
+        return false;
+
+    // topics are given as ["a", "b"] or {"topic": "a"}
+    QStringList topics;
+    const QJsonValue params = message.params();
+    if (params.isArray()) {
+        const QJsonArray array = params.toArray();
+        for (int i = 0; i < array.size(); ++i)
+            topics.append(array.at(i).toString());
+    } else if (params.isObject()) {
+        topics.append(params.toObject().value(QLatin1String("topic")).toString());
+    }
+
+    if (topics.isEmpty() || topics.contains(QString())) {
+        if (message.type() == QJsonRpcMessage::Request)
+            notifyClient(socket, message.createErrorResponse(QJsonRpc::InvalidParams, "invalid topic"));
+        return true;
+    }
+
+    foreach (const QString &topic, topics) {
+        if (subscribe) {
+            subscribers[topic].insert(socket);
+            subscriptions[socket].insert(topic);
+        } else {
+            QHash<QString, QSet<QJsonRpcSocket*> >::iterator it = subscribers.find(topic);
+            if (it != subscribers.end()) {
+                it.value().remove(socket);
+                if (it.value().isEmpty())
+                    subscribers.erase(it);
+            }
+
+            QHash<QJsonRpcSocket*, QSet<QString> >::iterator sit = subscriptions.find(socket);
+            if (sit != subscriptions.end()) {
+                sit.value().remove(topic);
+                if (sit.value().isEmpty())
+                    subscriptions.erase(sit);
+            }
+        }
+    }
+
+    if (message.type() == QJsonRpcMessage::Request)
+        notifyClient(socket, message.createResponse(true));
+    return true;
+}
+
+Qt::ConnectionType QJsonRpcAbstractServerPrivate::connectionType(QJsonRpcSocket *client)
+{
+    return client->thread() == QThread::currentThread() ? Qt::DirectConnection
+                                                        : Qt::QueuedConnection;
+}
+
+void QJsonRpcAbstractServerPrivate::notifyClient(QJsonRpcSocket *client,
+                                                 const QJsonRpcMessage &message)
+{
+    // clients of a QJsonRpcTcpServer may live in one of its worker threads
+    if (client->thread() == QThread::currentThread())
+        client->notify(message);
+    else
+        QMetaObject::invokeMethod(client, "notify", Qt::QueuedConnection,
+                                  Q_ARG(QJsonRpcMessage, message));
+}
+
+void QJsonRpcAbstractServerPrivate::removeClient(QJsonRpcSocket *socket)
+{
+    clients.removeAll(socket);
+
+    // only touches the topics this client subscribed to
+    const QSet<QString> topics = subscriptions.take(socket);
+    foreach (const QString &topic, topics) {
+        QHash<QString, QSet<QJsonRpcSocket*> >::iterator it = subscribers.find(topic);
+        if (it != subscribers.end()) {
+            it.value().remove(socket);
+            if (it.value().isEmpty())
+                subscribers.erase(it);
+        }
+    }
+}
+
 #include "moc_qjsonrpcabstractserver.cpp"
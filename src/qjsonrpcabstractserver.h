@@ -39,6 +39,12 @@ public:
     virtual bool addService(QJsonRpcService *service);
     virtual bool removeService(QJsonRpcService *service);
 
+    // msecs after receipt a request is still worth answering, -1 (the default)
+    // for no limit. Requests still waiting for a busy thread pool or a service
+    // in another thread then are answered with QJsonRpc::TimeoutError instead
+    int requestTimeout() const;
+    void setRequestTimeout(int msecs);
+
 protected:
     QJsonRpcServiceProvider();
     void processMessage(QJsonRpcSocket *socket, const QJsonRpcMessage &message);
@@ -63,16 +69,48 @@ public:
     void setWireFormat(QJsonDocument::JsonFormat format);
 #endif
 
+    QJsonRpc::Framing framing() const;
+    void setFraming(QJsonRpc::Framing framing);
+
+    QJsonRpc::Encoding encoding() const;
+    void setEncoding(QJsonRpc::Encoding encoding);
+
+    // applied to every client socket, see QJsonRpcSocket::setLazyParsingEnabled
+    bool isLazyParsingEnabled() const;
+    void setLazyParsingEnabled(bool enabled);
+
+    // applied to every client socket, see QJsonRpcSocket::setHighWaterMark
+    qint64 highWaterMark() const;
+    void setHighWaterMark(qint64 bytes);
+    qint64 lowWaterMark() const;
+    void setLowWaterMark(qint64 bytes);
+
+    // what notifyConnectedClients does with clients above their high water mark
+    enum SlowClientPolicy {
+        QueueMessages,
+        DropMessages,
+        DisconnectClient
+    };
+    SlowClientPolicy slowClientPolicy() const;
+    void setSlowClientPolicy(SlowClientPolicy policy);
+
 public Q_SLOTS:
     void notifyConnectedClients(const QJsonRpcMessage &message);
     void notifyConnectedClients(const QString &method, const QJsonArray &params);
 
+    // only clients subscribed to topic through rpc.subscribe
+    void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
+    void notifySubscribers(const QString &topic, const QString &method, const QJsonArray &params);
+
 protected:
     explicit QJsonRpcAbstractServer(QJsonRpcAbstractServerPrivate &dd, QObject *parent);
 
     Q_DECLARE_PRIVATE(QJsonRpcAbstractServer)
     Q_DISABLE_COPY(QJsonRpcAbstractServer)
     Q_PRIVATE_SLOT(d_func(), void _q_processMessage(const QJsonRpcMessage &message))
+
+private:
+    void notifyClients(const QList<QJsonRpcSocket*> &clients, const QJsonRpcMessage &message);
 };
 
 #endif
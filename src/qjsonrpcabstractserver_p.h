@@ -20,7 +20,11 @@
 #include <private/qobject_p.h>
 
 #include <QObjectCleanupHandler>
+#include <QPointer>
 #include <QHash>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
 #include <QByteArray>
 
 #if QT_VERSION >= 0x050000
@@ -35,11 +39,32 @@ class QJsonRpcService;
 class QJsonRpcServiceProviderPrivate
 {
 public:
+    QJsonRpcServiceProviderPrivate() : requestTimeout(-1) {}
     QByteArray serviceName(QJsonRpcService *service);
 
+    // services and routes are looked up from the worker threads of a
+    // QJsonRpcTcpServer while addService and removeService change them
+    QReadWriteLock lock;
     QHash<QByteArray, QJsonRpcService*> services;
     QObjectCleanupHandler cleanupHandler;
 
+    // the services still alive, waited for when the provider goes away
+    QList<QPointer<QJsonRpcService> > liveServices;
+
+    // "service.method" to the service and the method name within it, built
+    // by addService so requests are routed with a single lookup
+    struct Route
+    {
+        QJsonRpcService *service;
+        QByteArray method;
+    };
+    QHash<QString, Route> routes;
+    void addRoutes(const QByteArray &serviceName, QJsonRpcService *service);
+    void removeRoutes(QJsonRpcService *service);
+
+    // the deadline given to every request, guarded by lock as well
+    int requestTimeout;
+
 };
 
 class QJsonRpcSocket;
@@ -49,17 +74,45 @@ class QJsonRpcAbstractServerPrivate : public QObjectPrivate
 public:
 #if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
     QJsonDocument::JsonFormat format;
-    QJsonRpcAbstractServerPrivate() : format(QJsonDocument::Compact) {}
-#else
-    QJsonRpcAbstractServerPrivate() {}
 #endif
 
+    QJsonRpcAbstractServerPrivate()
+        : framing(QJsonRpc::StreamFraming),
+          encoding(QJsonRpc::TextEncoding),
+          lazyParsing(false),
+          highWaterMark(0),
+          lowWaterMark(0),
+          slowClientPolicy(QJsonRpcAbstractServer::QueueMessages)
+    {
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+        format = QJsonDocument::Compact;
+#endif
+    }
+
     virtual void _q_processIncomingConnection() = 0;
     virtual void _q_clientDisconnected() = 0;
     void _q_processMessage(const QJsonRpcMessage &message);
 
+    // built-in rpc.subscribe and rpc.unsubscribe methods
+    bool processSubscription(QJsonRpcSocket *socket, const QJsonRpcMessage &message);
+    void removeClient(QJsonRpcSocket *socket);
+
+    // safe for clients living in another thread
+    static Qt::ConnectionType connectionType(QJsonRpcSocket *client);
+    static void notifyClient(QJsonRpcSocket *client, const QJsonRpcMessage &message);
+
+    QJsonRpc::Framing framing;
+    QJsonRpc::Encoding encoding;
+    bool lazyParsing;
+    qint64 highWaterMark;
+    qint64 lowWaterMark;
+    QJsonRpcAbstractServer::SlowClientPolicy slowClientPolicy;
     QList<QJsonRpcSocket*> clients;
 
+    // topic subscriptions, in both directions
+    QHash<QString, QSet<QJsonRpcSocket*> > subscribers;
+    QHash<QJsonRpcSocket*, QSet<QString> > subscriptions;
+
 };
 
 #endif
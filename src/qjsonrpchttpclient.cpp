@@ -18,14 +18,19 @@
 
 #include <QEventLoop>
 #include <QTimer>
+#include <QPointer>
+#include <QHash>
 #include <QDebug>
 
 #if QT_VERSION >= 0x050000
 #include <QJsonDocument>
+#include <QJsonArray>
 #else
 #include "json/qjsondocument.h"
+#include "json/qjsonarray.h"
 #endif
 
+#include "qjsonrpcmessage_p.h"
 #include "qjsonrpcservicereply_p.h"
 #include "qjsonrpchttpclient.h"
 
@@ -52,8 +57,30 @@ public:
                     this, SLOT(networkReplyError(QNetworkReply::NetworkError)));
     }
 
+    // part of a batch, resolved through setResponse()
+    QJsonRpcHttpReply(const QJsonRpcMessage &request, QObject *parent = 0)
+        : QJsonRpcServiceReply(*new QJsonRpcHttpReplyPrivate, parent)
+    {
+        Q_D(QJsonRpcHttpReply);
+        d->request = request;
+        d->reply = 0;
+    }
+
     virtual ~QJsonRpcHttpReply() {}
 
+    QJsonRpcMessage request() const
+    {
+        Q_D(const QJsonRpcHttpReply);
+        return d->request;
+    }
+
+    void setResponse(const QJsonRpcMessage &response)
+    {
+        Q_D(QJsonRpcHttpReply);
+        d->response = response;
+        Q_EMIT finished();
+    }
+
 private Q_SLOTS:
     void networkReplyFinished()
     {
@@ -118,6 +145,81 @@ private:
 
 };
 
+/*
+ * Resolves the replies of a batch sent as a single POST: the response
+ * array is parsed once and each reply gets its element by id.
+ */
+class QJsonRpcHttpBatchReply : public QObject
+{
+    Q_OBJECT
+public:
+    QJsonRpcHttpBatchReply(const QList<QJsonRpcHttpReply*> &replies,
+                           QNetworkReply *reply, QObject *parent = 0)
+        : QObject(parent)
+    {
+        foreach (QJsonRpcHttpReply *batchReply, replies)
+            m_replies.insert(batchReply->request().id(), batchReply);
+        connect(reply, SIGNAL(finished()), this, SLOT(networkReplyFinished()));
+    }
+
+private Q_SLOTS:
+    void networkReplyFinished()
+    {
+        QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+        if (!reply) {
+            qDebug() << Q_FUNC_INFO << "invalid reply";
+            return;
+        }
+
+        if (reply->error() != QNetworkReply::NoError) {
+            setErrorResponses(QJsonRpc::InternalError, "error with http request",
+                              reply->errorString());
+        } else {
+            QByteArray data = reply->readAll();
+            QJsonDocument doc = QJsonDocument::fromJson(data);
+            if (qgetenv("QJSONRPC_DEBUG").toInt())
+                qDebug() << "received: " << doc.toJson();
+
+            if (doc.isArray()) {
+                const QJsonArray responses = doc.array();
+                for (int i = 0; i < responses.size(); ++i) {
+                    QJsonRpcMessage response(responses.at(i).toObject());
+                    QPointer<QJsonRpcHttpReply> batchReply = m_replies.take(response.id());
+                    if (batchReply)
+                        batchReply->setResponse(response);
+                }
+
+                setErrorResponses(QJsonRpc::InternalError, "no response in batch",
+                                  QString::fromUtf8(data));
+            } else if (doc.isObject()) {
+                // the batch as a whole was rejected
+                QJsonRpcMessage error(doc.object());
+                setErrorResponses(static_cast<QJsonRpc::ErrorCode>(error.errorCode()),
+                                  error.errorMessage(), error.errorData());
+            } else {
+                setErrorResponses(QJsonRpc::ParseError, "unable to process incoming JSON data",
+                                  QString::fromUtf8(data));
+            }
+        }
+
+        deleteLater();
+    }
+
+private:
+    void setErrorResponses(QJsonRpc::ErrorCode code, const QString &message,
+                           const QJsonValue &data)
+    {
+        foreach (QPointer<QJsonRpcHttpReply> batchReply, m_replies) {
+            if (batchReply)
+                batchReply->setResponse(batchReply->request().createErrorResponse(code, message, data));
+        }
+        m_replies.clear();
+    }
+
+    QHash<int, QPointer<QJsonRpcHttpReply> > m_replies;
+
+};
+
 class QJsonRpcHttpClientPrivate : public QObjectPrivate
 {
 public:
@@ -131,7 +233,19 @@ public:
     QNetworkReply *writeMessage(const QJsonRpcMessage &message) {
         QNetworkRequest request(endPoint);
         request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
-        QByteArray data = QJsonDocument(message.toObject()).toJson();
+        // not reused, the network access manager holds on to the body
+        QByteArray data;
+        message.serialize(data);
+        if (qgetenv("QJSONRPC_DEBUG").toInt())
+            qDebug() << "sending: " << data;
+        return networkAccessManager->post(request, data);
+    }
+
+    QNetworkReply *writeMessages(const QList<QJsonRpcMessage> &messages) {
+        QNetworkRequest request(endPoint);
+        request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+        QByteArray data;
+        QJsonRpcMessagePrivate::serializeBatch(messages, data);
         if (qgetenv("QJSONRPC_DEBUG").toInt())
             qDebug() << "sending: " << data;
         return networkAccessManager->post(request, data);
@@ -222,6 +336,40 @@ QJsonRpcServiceReply *QJsonRpcHttpClient::sendMessage(const QJsonRpcMessage &mes
     return new QJsonRpcHttpReply(message, reply);
 }
 
+QList<QJsonRpcServiceReply*> QJsonRpcHttpClient::sendMessages(const QList<QJsonRpcMessage> &messages)
+{
+    Q_D(QJsonRpcHttpClient);
+    QList<QJsonRpcServiceReply*> result;
+    if (d->endPoint.isEmpty()) {
+        qDebug() << Q_FUNC_INFO << "invalid endpoint specified";
+        return result;
+    }
+
+    if (messages.isEmpty())
+        return result;
+
+    int duplicateId;
+    if (!QJsonRpcMessagePrivate::hasUniqueRequestIds(messages, &duplicateId)) {
+        qDebug() << Q_FUNC_INFO << "duplicate request id" << duplicateId << "in batch";
+        return result;
+    }
+
+    // a single POST for the whole batch
+    QList<QJsonRpcHttpReply*> replies;
+    foreach (const QJsonRpcMessage &message, messages) {
+        if (message.type() == QJsonRpcMessage::Request) {
+            QJsonRpcHttpReply *reply = new QJsonRpcHttpReply(message);
+            replies.append(reply);
+            result.append(reply);
+        }
+    }
+
+    QNetworkReply *reply = d->writeMessages(messages);
+    connect(reply, SIGNAL(finished()), reply, SLOT(deleteLater()));
+    new QJsonRpcHttpBatchReply(replies, reply, this);
+    return result;
+}
+
 QJsonRpcMessage QJsonRpcHttpClient::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
 {
     QJsonRpcServiceReply *reply = sendMessage(message);
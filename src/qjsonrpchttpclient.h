@@ -48,6 +48,7 @@ public Q_SLOTS:
     virtual void notify(const QJsonRpcMessage &message);
     QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, int msecs = 30000);
     QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message);
+    QList<QJsonRpcServiceReply*> sendMessages(const QList<QJsonRpcMessage> &messages);
 
 protected Q_SLOTS:
     virtual void handleAuthenticationRequired(QNetworkReply *reply, QAuthenticator * authenticator);
@@ -17,15 +17,15 @@ class QJsonRpcHttpServerPrivate : public QJsonRpcTcpServerPrivate
     Q_DECLARE_PUBLIC(QJsonRpcHttpServer)
 public:
     QJsonRpcHttpServerPrivate() {}
-    QHash<QTcpSocket*, QJsonRpcHttpRequest*> requests;
 
-    virtual void _q_processIncomingConnection();
-    virtual void _q_clientDisconnected();
+    virtual QJsonRpcSocket *createSocket(QTcpSocket *tcpSocket, QObject *parent) const;
 };
 
 QJsonRpcHttpRequest::QJsonRpcHttpRequest(QAbstractSocket *socket, QObject *parent)
     : QIODevice(parent),
       m_requestSocket(socket),
+      m_receivedMessages(0),
+      m_expectsResponse(false),
       m_requestParser(0)
 {
     // initialize request parser
@@ -71,36 +71,38 @@ qint64 QJsonRpcHttpRequest::writeData(const char *data, qint64 maxSize)
 {
     m_responseBuffer.append(data, (int)maxSize);
     QJsonDocument document = QJsonDocument::fromJson(m_responseBuffer);
-    if (document.isObject()) {
-        // determine the HTTP code to respond with
+    if (document.isObject() || document.isArray()) {
+        // determine the HTTP code to respond with, batch responses are always 200
         int statusCode = 200;
-        QJsonRpcMessage message(document.object());
-        switch (message.type()) {
-        case QJsonRpcMessage::Error:
-            switch (message.errorCode()) {
-            case QJsonRpc::InvalidRequest:
-                statusCode = 400;
+        if (document.isObject()) {
+            QJsonRpcMessage message(document.object());
+            switch (message.type()) {
+            case QJsonRpcMessage::Error:
+                switch (message.errorCode()) {
+                case QJsonRpc::InvalidRequest:
+                    statusCode = 400;
+                    break;
+
+                case QJsonRpc::MethodNotFound:
+                    statusCode = 404;
+                    break;
+
+                default:
+                    statusCode = 500;
+                    break;
+                }
                 break;
 
-            case QJsonRpc::MethodNotFound:
-                statusCode = 404;
+            case QJsonRpcMessage::Invalid:
+                statusCode = 400;
                 break;
 
-            default:
-                statusCode = 500;
+            case QJsonRpcMessage::Notification:
+            case QJsonRpcMessage::Response:
+            case QJsonRpcMessage::Request:
+                statusCode = 200;
                 break;
             }
-            break;
-
-        case QJsonRpcMessage::Invalid:
-            statusCode = 400;
-            break;
-
-        case QJsonRpcMessage::Notification:
-        case QJsonRpcMessage::Response:
-        case QJsonRpcMessage::Request:
-            statusCode = 200;
-            break;
         }
 
         QTextStream os(m_requestSocket);
@@ -139,11 +141,37 @@ int QJsonRpcHttpRequest::onBody(http_parser *parser, const char *at, size_t leng
     return 0;
 }
 
+void QJsonRpcHttpRequest::messageReceived(const QJsonRpcMessage &message)
+{
+    // only notifications and responses go unanswered, see
+    // QJsonRpcServiceProvider::processMessage
+    m_receivedMessages++;
+    if (message.type() != QJsonRpcMessage::Notification &&
+        message.type() != QJsonRpcMessage::Response)
+        m_expectsResponse = true;
+}
+
 int QJsonRpcHttpRequest::onMessageComplete(http_parser *parser)
 {
     QJsonRpcHttpRequest *request = (QJsonRpcHttpRequest *)parser->data;
+    request->m_receivedMessages = 0;
+    request->m_expectsResponse = false;
     Q_EMIT request->readyRead();
 
+    // the socket drops a body it can't parse without a word, answer for it
+    if (!request->m_receivedMessages) {
+        QByteArray body;
+        QJsonRpcMessage().createErrorResponse(QJsonRpc::ParseError, "parse error").serialize(body);
+        request->write(body);
+        return 0;
+    }
+
+    // don't leave the client waiting for an answer that never comes
+    if (!request->m_expectsResponse) {
+        request->m_requestSocket->write("HTTP/1.1 204 No Content\r\n\r\n");
+        request->m_requestSocket->close();
+    }
+
     return 0;
 }
 
@@ -239,41 +267,15 @@ QJsonRpcHttpServer::~QJsonRpcHttpServer()
  * TODO: handle ssl configurations directly in the server part by overriding
  * nextPendingConnection() method.
  */
-void QJsonRpcHttpServerPrivate::_q_processIncomingConnection()
+QJsonRpcSocket *QJsonRpcHttpServerPrivate::createSocket(QTcpSocket *tcpSocket, QObject *parent) const
 {
-    Q_Q(QJsonRpcHttpServer);
-    QTcpSocket *tcpSocket = server->nextPendingConnection();
-    if (!tcpSocket) {
-        qDebug() << Q_FUNC_INFO << "nextPendingConnection is null";
-        return;
-    }
-
-    QJsonRpcHttpRequest *request = new QJsonRpcHttpRequest(tcpSocket, q);
-    QJsonRpcSocket *socket = new QJsonRpcSocket(request, q);
-#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
-    socket->setWireFormat(format);
-#endif
-
+    // the request owns the tcp socket, the rpc socket owns the request
+    QJsonRpcHttpRequest *request = new QJsonRpcHttpRequest(tcpSocket);
+    QJsonRpcSocket *socket = new QJsonRpcSocket(request, parent);
+    request->setParent(socket);
     QObject::connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
-                     q, SLOT(_q_processMessage(QJsonRpcMessage)));
-    clients.append(socket);
-    QObject::connect(tcpSocket, SIGNAL(disconnected()),
-                     q, SLOT(_q_clientDisconnected()));
-    socketLookup.insert(tcpSocket, socket);
-    requests.insert(tcpSocket, request);
-}
-
-void QJsonRpcHttpServerPrivate::_q_clientDisconnected()
-{
-    Q_Q(QJsonRpcHttpServer);
-    QTcpSocket *tcpSocket = static_cast<QTcpSocket*>(q->sender());
-    if (tcpSocket) {
-        if (requests.contains(tcpSocket)) {
-            QJsonRpcHttpRequest *req = requests.take(tcpSocket);
-            req->deleteLater();
-        }
-    }
-    QJsonRpcTcpServerPrivate::_q_clientDisconnected();
+                     request, SLOT(messageReceived(QJsonRpcMessage)));
+    return socket;
 }
 
 #include "moc_qjsonrpchttpserver.cpp"
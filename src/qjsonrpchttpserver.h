@@ -30,8 +30,6 @@ public:
 protected:
     Q_DECLARE_PRIVATE(QJsonRpcHttpServer)
     Q_DISABLE_COPY(QJsonRpcHttpServer)
-    Q_PRIVATE_SLOT(d_func(), void _q_processIncomingConnection())
-    Q_PRIVATE_SLOT(d_func(), void _q_clientDisconnected())
 
 };
 
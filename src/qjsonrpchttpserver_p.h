@@ -6,6 +6,7 @@
 
 #include "http_parser.h"
 #include "qjsonrpcservice.h"
+#include "qjsonrpcmessage.h"
 
 class QAbstractSocket;
 class QJsonRpcHttpRequest : public QIODevice
@@ -21,6 +22,10 @@ protected:
     qint64 readData(char *data, qint64 maxSize);
     qint64 writeData(const char *data, qint64 maxSize);
 
+public Q_SLOTS:
+    // counts what the rpc socket made of the request body
+    void messageReceived(const QJsonRpcMessage &message);
+
 private Q_SLOTS:
     void readIncomingData();
 
@@ -37,6 +42,8 @@ private:
     Q_DISABLE_COPY(QJsonRpcHttpRequest)
 
     QAbstractSocket *m_requestSocket;
+    int m_receivedMessages;
+    bool m_expectsResponse;
 
     // request
     QByteArray m_requestPayload;
@@ -59,6 +59,11 @@ void QJsonRpcLocalServerPrivate::_q_processIncomingConnection()
 #if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
     socket->setWireFormat(format);
 #endif
+    socket->setFraming(framing);
+    socket->setEncoding(encoding);
+    socket->setLazyParsingEnabled(lazyParsing);
+    socket->setHighWaterMark(highWaterMark);
+    socket->setLowWaterMark(lowWaterMark);
 
     QObject::connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
                           q, SLOT(_q_processMessage(QJsonRpcMessage)));
@@ -74,7 +79,7 @@ void QJsonRpcLocalServerPrivate::_q_clientDisconnected()
     if (localSocket) {
         if (socketLookup.contains(localSocket)) {
             QJsonRpcSocket *socket = socketLookup.take(localSocket);
-            clients.removeAll(socket);
+            removeClient(socket);
             socket->deleteLater();
         }
 
@@ -15,7 +15,12 @@
  * Lesser General Public License for more details.
  */
 
+#include <string.h>
+#include <ctype.h>
+
+#include <QSet>
 #include <QDebug>
+#include <qnumeric.h>
 
 #if QT_VERSION >= 0x050000
 #   include <QJsonDocument>
@@ -23,38 +28,39 @@
 #   include "json/qjsondocument.h"
 #endif
 
+#include "qjsonrpcmessage_p.h"
 #include "qjsonrpcmessage.h"
 
-class QJsonRpcMessagePrivate : public QSharedData
-{
-public:
-    QJsonRpcMessagePrivate();
-    ~QJsonRpcMessagePrivate();
-    QJsonRpcMessagePrivate(const QJsonRpcMessagePrivate &other);
-
-    void initializeWithObject(const QJsonObject &message);
-    static QJsonRpcMessage createBasicRequest(const QString &method, const QJsonArray &params);
-    static QJsonRpcMessage createBasicRequest(const QString &method,
-                                              const QJsonObject &namedParameters);
-
-    QJsonRpcMessage::Type type;
-    QScopedPointer<QJsonObject> object;
-
-    static int uniqueRequestCounter;
-};
-
 int QJsonRpcMessagePrivate::uniqueRequestCounter = 0;
 
+static inline QJsonValue *loadParsedParams(const QAtomicPointer<QJsonValue> &parsedParams)
+{
+#if QT_VERSION >= 0x050000
+    return parsedParams.loadAcquire();
+#else
+    return parsedParams;
+#endif
+}
+
 QJsonRpcMessagePrivate::QJsonRpcMessagePrivate()
     : type(QJsonRpcMessage::Invalid),
-      object(0)
+      object(0),
+      paramsOffset(-1),
+      paramsLength(0),
+      parsedParams(0)
 {
 }
 
 QJsonRpcMessagePrivate::QJsonRpcMessagePrivate(const QJsonRpcMessagePrivate &other)
     : QSharedData(other),
       type(other.type),
-      object(other.object ? new QJsonObject(*other.object) : 0)
+      object(other.object ? new QJsonObject(*other.object) : 0),
+      encodedPayloads(other.encodedPayloads),
+      raw(other.raw),
+      paramsOffset(other.paramsOffset),
+      paramsLength(other.paramsLength),
+      parsedParams(loadParsedParams(other.parsedParams) ?
+                   new QJsonValue(*loadParsedParams(other.parsedParams)) : 0)
 {
 }
 
@@ -80,6 +86,342 @@ void QJsonRpcMessagePrivate::initializeWithObject(const QJsonObject &message)
 
 QJsonRpcMessagePrivate::~QJsonRpcMessagePrivate()
 {
+    delete loadParsedParams(parsedParams);
+}
+
+static inline int skipWhitespace(const char *data, int pos, int size)
+{
+    while (pos < size && (data[pos] == ' ' || data[pos] == '\t' ||
+                          data[pos] == '\n' || data[pos] == '\r'))
+        ++pos;
+    return pos;
+}
+
+/*
+ * pos is at the lead byte of a multi byte UTF-8 sequence, returns the
+ * position of its last byte or -1 for what the json parser refuses:
+ * broken or truncated sequences, overlong forms, surrogates, code points
+ * past U+10FFFF and non-characters.
+ */
+static inline int skipUtf8Char(const char *data, int pos, int size)
+{
+    uchar c = data[pos];
+    int need;
+    uint uc;
+    uint min_uc;
+    if ((c & 0xe0) == 0xc0) {
+        uc = c & 0x1f;
+        need = 1;
+        min_uc = 0x80;
+    } else if ((c & 0xf0) == 0xe0) {
+        uc = c & 0x0f;
+        need = 2;
+        min_uc = 0x800;
+    } else if ((c & 0xf8) == 0xf0) {
+        uc = c & 0x07;
+        need = 3;
+        min_uc = 0x10000;
+    } else {
+        return -1;
+    }
+
+    if (size - pos <= need)
+        return -1;
+    for (int i = 0; i < need; ++i) {
+        c = data[++pos];
+        if ((c & 0xc0) != 0x80)
+            return -1;
+        uc = (uc << 6) | (c & 0x3f);
+    }
+
+    if (uc < min_uc || uc >= 0x110000 || (uc >= 0xd800 && uc <= 0xdfff) ||
+        (uc & 0xfffe) == 0xfffe || (uc >= 0xfdd0 && uc <= 0xfdef))
+        return -1;
+    return pos;
+}
+
+/*
+ * pos is at the opening quote, returns the position after the closing one
+ * or -1 if the string isn't valid json. escaped tells whether the string
+ * needs unescaping.
+ */
+static inline int skipString(const char *data, int pos, int size, bool *escaped)
+{
+    *escaped = false;
+    for (++pos; pos < size; ++pos) {
+        const uchar c = data[pos];
+        if (c == '"')
+            return pos + 1;
+        if (c < 0x20)
+            return -1;
+        if (c >= 0x80) {
+            if ((pos = skipUtf8Char(data, pos, size)) == -1)
+                return -1;
+            continue;
+        }
+        if (c != '\\')
+            continue;
+
+        *escaped = true;
+        if (++pos == size)
+            return -1;
+        switch (data[pos]) {
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+            break;
+        case 'u':
+            if (size - pos <= 4 || !isxdigit(uchar(data[pos + 1])) || !isxdigit(uchar(data[pos + 2])) ||
+                !isxdigit(uchar(data[pos + 3])) || !isxdigit(uchar(data[pos + 4])))
+                return -1;
+            pos += 4;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static inline int skipDigits(const char *data, int pos, int size)
+{
+    const int start = pos;
+    while (pos < size && data[pos] >= '0' && data[pos] <= '9')
+        ++pos;
+    return pos > start ? pos : -1;
+}
+
+static int skipNumber(const char *data, int pos, int size)
+{
+    if (pos < size && data[pos] == '-')
+        ++pos;
+    if (pos < size && data[pos] == '0')
+        ++pos;
+    else if ((pos = skipDigits(data, pos, size)) == -1)
+        return -1;
+
+    if (pos < size && data[pos] == '.' && (pos = skipDigits(data, pos + 1, size)) == -1)
+        return -1;
+    if (pos < size && (data[pos] == 'e' || data[pos] == 'E')) {
+        ++pos;
+        if (pos < size && (data[pos] == '+' || data[pos] == '-'))
+            ++pos;
+        pos = skipDigits(data, pos, size);
+    }
+    return pos;
+}
+
+static inline int skipLiteral(const char *data, int pos, int size, const char *literal, int length)
+{
+    if (size - pos < length || memcmp(data + pos, literal, length) != 0)
+        return -1;
+    return pos + length;
+}
+
+/*
+ * Returns the position after the value starting at pos, or -1 if it isn't
+ * valid json. Nothing is built, but the whole grammar is checked, so params
+ * left unparsed are known to parse when first used.
+ */
+static int skipValue(const char *data, int pos, int size, int depth = 0)
+{
+    enum { MaxDepth = 1024 };   // QJsonDocument's own nesting limit
+    if (pos >= size || depth > MaxDepth)
+        return -1;
+
+    bool escaped;
+    switch (data[pos]) {
+    case '"':
+        return skipString(data, pos, size, &escaped);
+    case '{':
+    case '[': {
+        const bool object = data[pos] == '{';
+        const char close = object ? '}' : ']';
+        pos = skipWhitespace(data, pos + 1, size);
+        if (pos < size && data[pos] == close)
+            return pos + 1;
+
+        for (;;) {
+            if (object) {
+                if (pos >= size || data[pos] != '"')
+                    return -1;
+                if ((pos = skipString(data, pos, size, &escaped)) == -1)
+                    return -1;
+                pos = skipWhitespace(data, pos, size);
+                if (pos >= size || data[pos] != ':')
+                    return -1;
+                pos = skipWhitespace(data, pos + 1, size);
+            }
+            if ((pos = skipValue(data, pos, size, depth + 1)) == -1)
+                return -1;
+            pos = skipWhitespace(data, pos, size);
+            if (pos >= size)
+                return -1;
+            if (data[pos] == close)
+                return pos + 1;
+            if (data[pos] != ',')
+                return -1;
+            pos = skipWhitespace(data, pos + 1, size);
+        }
+    }
+    case 't':
+        return skipLiteral(data, pos, size, "true", 4);
+    case 'f':
+        return skipLiteral(data, pos, size, "false", 5);
+    case 'n':
+        return skipLiteral(data, pos, size, "null", 4);
+    default:
+        return skipNumber(data, pos, size);
+    }
+}
+
+// envelope members are plain strings, numbers, booleans or null
+static bool scalarValue(const char *data, int size, QJsonValue *value)
+{
+    if (data[0] == '"') {
+        if (memchr(data, '\\', size))
+            return false;
+        *value = QString::fromUtf8(data + 1, size - 2);
+        return true;
+    }
+
+    const QByteArray token = QByteArray::fromRawData(data, size);
+    if (token == "null") {
+        *value = QJsonValue(QJsonValue::Null);
+    } else if (token == "true") {
+        *value = true;
+    } else if (token == "false") {
+        *value = false;
+    } else {
+        bool ok;
+        const double number = token.toDouble(&ok);
+        if (!ok)
+            return false;
+        *value = number;
+    }
+    return true;
+}
+
+bool QJsonRpcMessagePrivate::parseEnvelope(const QByteArray &json, QJsonRpcMessage *message)
+{
+    const char *data = json.constData();
+    const int size = json.size();
+    QJsonObject envelope;
+    int paramsOffset = -1;
+    int paramsLength = 0;
+
+    int pos = skipWhitespace(data, 0, size);
+    if (pos == size || data[pos] != '{')
+        return false;
+    pos = skipWhitespace(data, pos + 1, size);
+    if (pos == size || data[pos] == '}')
+        return false;
+
+    for (;;) {
+        bool escaped;
+        if (pos == size || data[pos] != '"')
+            return false;
+        const int keyEnd = skipString(data, pos, size, &escaped);
+        if (keyEnd == -1 || escaped)
+            return false;
+        const QByteArray key = QByteArray::fromRawData(data + pos + 1, keyEnd - pos - 2);
+
+        pos = skipWhitespace(data, keyEnd, size);
+        if (pos == size || data[pos] != ':')
+            return false;
+        pos = skipWhitespace(data, pos + 1, size);
+        const int valueEnd = skipValue(data, pos, size);
+        if (valueEnd == -1)
+            return false;
+
+        if (key == "params") {
+            paramsOffset = pos;
+            paramsLength = valueEnd - pos;
+        } else if (key == "jsonrpc" || key == "method" || key == "id") {
+            QJsonValue value;
+            if (!scalarValue(data + pos, valueEnd - pos, &value))
+                return false;
+            envelope.insert(QString::fromLatin1(key.constData(), key.size()), value);
+        } else {
+            // responses, errors and extension members are parsed in full
+            return false;
+        }
+
+        pos = skipWhitespace(data, valueEnd, size);
+        if (pos == size)
+            return false;
+        if (data[pos] == '}')
+            break;
+        if (data[pos] != ',')
+            return false;
+        pos = skipWhitespace(data, pos + 1, size);
+    }
+
+    if (skipWhitespace(data, pos + 1, size) != size)
+        return false;
+
+    QJsonRpcMessage result;
+    result.d->initializeWithObject(envelope);
+    if (result.d->type != QJsonRpcMessage::Request &&
+        result.d->type != QJsonRpcMessage::Notification)
+        return false;
+
+    if (paramsOffset != -1) {
+        result.d->raw = json;
+        result.d->paramsOffset = paramsOffset;
+        result.d->paramsLength = paramsLength;
+    }
+    *message = result;
+    return true;
+}
+
+QJsonValue QJsonRpcMessagePrivate::lazyParams() const
+{
+    QJsonValue *params = loadParsedParams(parsedParams);
+    if (params)
+        return *params;
+
+    // params are an array or object, anything else is wrapped to parse it
+    const char *data = raw.constData() + paramsOffset;
+    QJsonDocument document;
+    if (data[0] == '[' || data[0] == '{') {
+        document = QJsonDocument::fromJson(QByteArray::fromRawData(data, paramsLength));
+    } else {
+        QByteArray wrapped;
+        wrapped.reserve(paramsLength + 2);
+        wrapped.append('[');
+        wrapped.append(data, paramsLength);
+        wrapped.append(']');
+        document = QJsonDocument::fromJson(wrapped);
+    }
+
+    QJsonValue *value;
+    if (document.isObject())
+        value = new QJsonValue(document.object());
+    else if (document.isArray() && data[0] == '[')
+        value = new QJsonValue(document.array());
+    else if (document.isArray())
+        value = new QJsonValue(document.array().at(0));
+    else {
+        qWarning() << Q_FUNC_INFO << "invalid params: " << QByteArray(data, paramsLength);
+        value = new QJsonValue(QJsonValue::Undefined);
+    }
+
+    // another thread may have been first, it parsed the same thing
+    if (!parsedParams.testAndSetOrdered(0, value)) {
+        delete value;
+        value = loadParsedParams(parsedParams);
+    }
+    return *value;
+}
+
+QByteArray QJsonRpcMessagePrivate::encodedPayload(const QJsonRpcMessage &message, int key)
+{
+    return message.d->encodedPayloads.value(key);
+}
+
+void QJsonRpcMessagePrivate::setEncodedPayload(QJsonRpcMessage &message, int key,
+                                               const QByteArray &payload)
+{
+    message.d->encodedPayloads.insert(key, payload);
 }
 
 QJsonRpcMessage::QJsonRpcMessage()
@@ -128,6 +470,100 @@ bool QJsonRpcMessage::operator==(const QJsonRpcMessage &message) const
     return false;
 }
 
+static void serializeString(QByteArray &out, const QString &string)
+{
+    const QByteArray utf8 = string.toUtf8();
+    const char *data = utf8.constData();
+    const int size = utf8.size();
+
+    out.append('"');
+    int start = 0;
+    for (int i = 0; i < size; ++i) {
+        const uchar c = data[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        out.append(data + start, i - start);
+        switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default: {
+            static const char hex[] = "0123456789abcdef";
+            const char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+            out.append(escape, 6);
+        }
+        }
+        start = i + 1;
+    }
+    out.append(data + start, size - start);
+    out.append('"');
+}
+
+static void serializeNumber(QByteArray &out, double number)
+{
+    // like QJsonDocument, which has no representation for inf and nan either
+    if (!qIsFinite(number)) {
+        out.append("null");
+        return;
+    }
+
+    // integers are exact up to 2^53, write them without an exponent
+    if (qAbs(number) < 9007199254740992.0 && number == double(qint64(number)))
+        out.append(QByteArray::number(qint64(number)));
+    else
+        out.append(QByteArray::number(number, 'g', 17));
+}
+
+static void serializeDocument(QByteArray &out, const QJsonDocument &document)
+{
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+    out.append(document.toJson(QJsonDocument::Compact));
+#else
+    QByteArray data = document.toJson();
+    data.replace('\n', "");   // newlines only ever appear between tokens
+    out.append(data);
+#endif
+}
+
+static void serializeValue(QByteArray &out, const QJsonValue &value)
+{
+    switch (value.type()) {
+    case QJsonValue::Bool:
+        out.append(value.toBool() ? "true" : "false");
+        break;
+    case QJsonValue::Double:
+        serializeNumber(out, value.toDouble());
+        break;
+    case QJsonValue::String:
+        serializeString(out, value.toString());
+        break;
+    case QJsonValue::Array:
+        serializeDocument(out, QJsonDocument(value.toArray()));
+        break;
+    case QJsonValue::Object:
+        serializeDocument(out, QJsonDocument(value.toObject()));
+        break;
+    default:
+        out.append("null");
+        break;
+    }
+}
+
+static void serializeMember(QByteArray &out, const QString &key, const QJsonValue &value)
+{
+    if (out.at(out.size() - 1) != '{')
+        out.append(',');
+    serializeString(out, key);
+    out.append(':');
+    serializeValue(out, value);
+}
+
+
 QJsonRpcMessage::QJsonRpcMessage(const QByteArray &message)
     : d(new QJsonRpcMessagePrivate)
 {
@@ -152,11 +588,86 @@ QJsonRpcMessage::QJsonRpcMessage(const QJsonObject &message)
     d->initializeWithObject(message);
 }
 
+QJsonRpcMessage QJsonRpcMessage::fromEnvelope(const QByteArray &message)
+{
+    QJsonRpcMessage result;
+    if (!QJsonRpcMessagePrivate::parseEnvelope(message, &result))
+        return QJsonRpcMessage(message);
+    return result;
+}
+
 QJsonObject QJsonRpcMessage::toObject() const
 {
-    if (d->object)
-        return QJsonObject(*d->object);
-    return QJsonObject();
+    if (!d->object)
+        return QJsonObject();
+
+    QJsonObject object(*d->object);
+    if (d->paramsOffset != -1)
+        object.insert(QLatin1String("params"), d->lazyParams());
+    return object;
+}
+
+void QJsonRpcMessage::serialize(QByteArray &out) const
+{
+    out.append('{');
+    if (!d->object) {
+        out.append('}');
+        return;
+    }
+
+    const QJsonObject &object = *d->object;
+    int written = 0;
+
+    // almost every message is 2.0, its member is written as one constant
+    QJsonObject::const_iterator it = object.constFind(QLatin1String("jsonrpc"));
+    if (it != object.constEnd()) {
+        const QJsonValue version = it.value();
+        if (version.isString() && version.toString() == QLatin1String("2.0"))
+            out.append("\"jsonrpc\":\"2.0\"");
+        else
+            serializeMember(out, QLatin1String("jsonrpc"), version);
+        written++;
+    }
+
+    static const char * const envelope[] = { "id", "method", "params", "result", "error" };
+    for (uint i = 0; i < sizeof(envelope) / sizeof(envelope[0]); ++i) {
+        const QLatin1String key(envelope[i]);
+        if (i == 2 && d->paramsOffset != -1) {
+            // unparsed params are copied as they came in, unless they
+            // span lines which a newline delimited peer would split on
+            const char *data = d->raw.constData() + d->paramsOffset;
+            if (!loadParsedParams(d->parsedParams) &&
+                !memchr(data, '\n', d->paramsLength) && !memchr(data, '\r', d->paramsLength)) {
+                if (out.at(out.size() - 1) != '{')
+                    out.append(',');
+                out.append("\"params\":");
+                out.append(data, d->paramsLength);
+            } else {
+                serializeMember(out, key, d->lazyParams());
+            }
+            continue;
+        }
+
+        it = object.constFind(key);
+        if (it == object.constEnd())
+            continue;
+        serializeMember(out, key, it.value());
+        written++;
+    }
+
+    // anything beyond the envelope follows in the object's own order
+    if (written < object.size()) {
+        for (it = object.constBegin(); it != object.constEnd(); ++it) {
+            const QString key = it.key();
+            if (key == QLatin1String("jsonrpc") || key == QLatin1String("id") ||
+                key == QLatin1String("method") || key == QLatin1String("params") ||
+                key == QLatin1String("result") || key == QLatin1String("error"))
+                continue;
+            serializeMember(out, key, it.value());
+        }
+    }
+
+    out.append('}');
 }
 
 bool QJsonRpcMessage::isValid() const
@@ -169,6 +680,34 @@ QJsonRpcMessage::Type QJsonRpcMessage::type() const
     return d->type;
 }
 
+bool QJsonRpcMessagePrivate::hasUniqueRequestIds(const QList<QJsonRpcMessage> &messages,
+                                                 int *duplicateId)
+{
+    QSet<int> ids;
+    foreach (const QJsonRpcMessage &message, messages) {
+        if (message.type() != QJsonRpcMessage::Request)
+            continue;
+        if (ids.contains(message.id())) {
+            *duplicateId = message.id();
+            return false;
+        }
+        ids.insert(message.id());
+    }
+
+    return true;
+}
+
+void QJsonRpcMessagePrivate::serializeBatch(const QList<QJsonRpcMessage> &messages, QByteArray &out)
+{
+    out.append('[');
+    for (int i = 0; i < messages.size(); ++i) {
+        if (i)
+            out.append(',');
+        messages.at(i).serialize(out);
+    }
+    out.append(']');
+}
+
 QJsonRpcMessage QJsonRpcMessagePrivate::createBasicRequest(const QString &method, const QJsonArray &params)
 {
     QJsonRpcMessage request;
@@ -303,6 +842,8 @@ QJsonValue QJsonRpcMessage::params() const
         return QJsonValue();
     if (!d->object)
         return QJsonValue();
+    if (d->paramsOffset != -1)
+        return d->lazyParams();
 
     return d->object->value(QLatin1String("params"));
 }
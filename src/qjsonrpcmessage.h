@@ -46,6 +46,23 @@ namespace QJsonRpc {
         UserError       = -32099,           // Anything after this is user defined
         TimeoutError    = -32100
     };
+
+    // how messages are delimited on the underlying device
+    enum Framing {
+        StreamFraming,          // documents are delimited by scanning for their end
+        ContentLengthFraming,   // "Content-Length: <size>\r\n\r\n" header before each message
+        LengthPrefixFraming,    // 32 bit big endian size before each message
+        NewlineFraming          // compact documents terminated by '\n' (NDJSON)
+    };
+
+    // how outgoing messages are encoded, incoming messages are always auto-detected.
+    // The binary representation is deprecated in Qt 5.15, from there on binary
+    // encoding is not available and incoming binary documents are skipped
+    enum Encoding {
+        TextEncoding,           // JSON text, see wireFormat()
+        BinaryEncoding,         // QJsonDocument binary representation ("qbjs")
+        MatchPeerEncoding       // text until the peer sends a binary document, then binary
+    };
 }
 
 class QJsonRpcMessagePrivate;
@@ -78,6 +95,10 @@ public:
     static QJsonRpcMessage createNotification(const QString &method,
                                               const QJsonObject &namedParameters);
 
+    // like QJsonRpcMessage(const QByteArray &), but parses the params of
+    // requests and notifications only once params() is called
+    static QJsonRpcMessage fromEnvelope(const QByteArray &message);
+
     QJsonRpcMessage createResponse(const QJsonValue &result) const;
     QJsonRpcMessage createErrorResponse(QJsonRpc::ErrorCode code,
                                         const QString &message = QString(),
@@ -100,6 +121,11 @@ public:
     QJsonValue errorData() const;
 
     QJsonObject toObject() const;
+
+    // appends the message as compact json text to out, envelope members
+    // first in a fixed order; out can be reused across messages
+    void serialize(QByteArray &out) const;
+
     bool operator==(const QJsonRpcMessage &message) const;
     inline bool operator!=(const QJsonRpcMessage &message) const { return !(operator==(message)); }
 
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCMESSAGE_P_H
+#define QJSONRPCMESSAGE_P_H
+
+#include <QSharedData>
+#include <QScopedPointer>
+#include <QAtomicPointer>
+#include <QHash>
+#include <QByteArray>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonObject>
+#include <QJsonArray>
+#else
+#include "json/qjsonobject.h"
+#include "json/qjsonarray.h"
+#endif
+
+#include "qjsonrpcmessage.h"
+
+class QJsonRpcMessagePrivate : public QSharedData
+{
+public:
+    QJsonRpcMessagePrivate();
+    ~QJsonRpcMessagePrivate();
+    QJsonRpcMessagePrivate(const QJsonRpcMessagePrivate &other);
+
+    void initializeWithObject(const QJsonObject &message);
+    static QJsonRpcMessage createBasicRequest(const QString &method, const QJsonArray &params);
+    static QJsonRpcMessage createBasicRequest(const QString &method,
+                                              const QJsonObject &namedParameters);
+
+    /*
+     * For the batch senders: responses are matched to replies by id, so a
+     * batch must not use a request id twice. Returns false and sets
+     * duplicateId if it does.
+     */
+    static bool hasUniqueRequestIds(const QList<QJsonRpcMessage> &messages, int *duplicateId);
+
+    // appends the compact text of messages as one batch array to out
+    static void serializeBatch(const QList<QJsonRpcMessage> &messages, QByteArray &out);
+
+    /*
+     * Payloads encoded ahead of time, keyed by the socket's encoding
+     * settings. A broadcast fills these once, so every client socket
+     * writes the same implicitly shared bytes instead of serializing the
+     * message again.
+     */
+    static QByteArray encodedPayload(const QJsonRpcMessage &message, int key);
+    static void setEncodedPayload(QJsonRpcMessage &message, int key, const QByteArray &payload);
+
+    /*
+     * Reads only the envelope (jsonrpc, id and method) of a request or
+     * notification, params stay unparsed in json until first used. They
+     * are still checked to be valid json with well formed UTF-8 strings,
+     * which is at least as strict as the full parse: a message it would
+     * reject is never accepted here. Escaped surrogates are not checked for
+     * pairing, the full parse takes them as they are too. Returns false for
+     * anything else, which then needs a full parse.
+     */
+    static bool parseEnvelope(const QByteArray &json, QJsonRpcMessage *message);
+    QJsonValue lazyParams() const;
+
+    QJsonRpcMessage::Type type;
+    QScopedPointer<QJsonObject> object;
+    QHash<int, QByteArray> encodedPayloads;
+
+    // set by parseEnvelope, where params are found in raw
+    QByteArray raw;
+    int paramsOffset;
+    int paramsLength;
+    mutable QAtomicPointer<QJsonValue> parsedParams;
+
+    static int uniqueRequestCounter;
+};
+
+#endif
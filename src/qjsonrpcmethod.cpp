@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include "qjsonrpcmethod.h"
+
+QJsonRpcMethodInvoker::QJsonRpcMethodInvoker(int argumentCount, const QStringList &parameterNames)
+    : m_argumentCount(argumentCount),
+      m_parameterNames(parameterNames)
+{
+}
+
+QJsonRpcMethodInvoker::~QJsonRpcMethodInvoker()
+{
+}
+
+int QJsonRpcMethodInvoker::argumentCount() const
+{
+    return m_argumentCount;
+}
+
+bool QJsonRpcMethodInvoker::invoke(QJsonRpcService *service, const QJsonValue &params,
+                                   QJsonValue *result, QString *errorMessage) const
+{
+    // bound straight from params, no intermediate array
+    QJsonValue arguments[MaxArguments];
+    if (params.isObject()) {
+        if (m_parameterNames.size() != m_argumentCount) {
+            *errorMessage = QLatin1String("method takes no named parameters");
+            return false;
+        }
+
+        const QJsonObject object = params.toObject();
+        for (int i = 0; i < m_parameterNames.size(); ++i) {
+            QJsonObject::const_iterator it = object.constFind(m_parameterNames.at(i));
+            if (it == object.constEnd()) {
+                *errorMessage = QString("missing parameter '%1'").arg(m_parameterNames.at(i));
+                return false;
+            }
+            arguments[i] = it.value();
+        }
+    } else {
+        const QJsonArray array = params.toArray();
+        if (array.size() != m_argumentCount) {
+            *errorMessage = QString("expected %1 parameters, got %2")
+                                .arg(m_argumentCount).arg(array.size());
+            return false;
+        }
+
+        for (int i = 0; i < m_argumentCount; ++i)
+            arguments[i] = array.at(i);
+    }
+
+    int failed = call(service, arguments, result);
+    if (failed != -1) {
+        if (failed < m_parameterNames.size())
+            *errorMessage = QString("failed to convert '%1' object from JSon").arg(m_parameterNames.at(failed));
+        else
+            *errorMessage = QString("failed to convert parameter %1 from JSon").arg(failed);
+        return false;
+    }
+
+    return true;
+}
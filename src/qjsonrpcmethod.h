@@ -0,0 +1,471 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCMETHOD_H
+#define QJSONRPCMETHOD_H
+
+#include <math.h>
+#include <limits>
+
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+#if QT_VERSION >= 0x050000
+#include <QJsonValue>
+#include <QJsonArray>
+#include <QJsonObject>
+#else
+#include "json/qjsonvalue.h"
+#include "json/qjsonarray.h"
+#include "json/qjsonobject.h"
+#endif
+
+#include "qjsonrpc_export.h"
+
+/*
+ * Support for QJsonRpcService::registerMethod: methods whose argument and
+ * return types are known at compile time, converted straight from and to
+ * QJsonValue and called through a member function pointer.
+ */
+
+// direct conversions, anything else goes through QVariant
+template <typename T>
+struct QJsonRpcTypeConverter
+{
+    static bool fromJson(const QJsonValue &value, T *out) {
+        QVariant variant = value.toVariant();
+        if (!variant.canConvert<T>())
+            return false;
+        *out = variant.value<T>();
+        return true;
+    }
+
+    static QJsonValue toJson(const T &value) {
+        return QJsonValue::fromVariant(QVariant::fromValue(value));
+    }
+};
+
+/*
+ * Numbers are rounded to integers the way QVariant does. The peer picks
+ * them, so values that don't fit the type, or aren't finite, are refused
+ * rather than cast.
+ */
+template <typename T>
+inline bool qjsonRpcNumberToInteger(double number, T *out)
+{
+    const double rounded = floor(number + 0.5);
+    const double limit = ldexp(1.0, std::numeric_limits<T>::digits);
+    const double lowest = std::numeric_limits<T>::is_signed ? -limit : 0.0;
+    if (!(rounded >= lowest && rounded < limit))
+        return false;
+    *out = static_cast<T>(rounded);
+    return true;
+}
+
+#define QJSONRPC_INTEGER_CONVERTER(Type) \
+template <> \
+struct QJsonRpcTypeConverter<Type> \
+{ \
+    static bool fromJson(const QJsonValue &value, Type *out) { \
+        return value.isDouble() && qjsonRpcNumberToInteger(value.toDouble(), out); \
+    } \
+    static QJsonValue toJson(Type value) { return QJsonValue(static_cast<double>(value)); } \
+};
+
+QJSONRPC_INTEGER_CONVERTER(short)
+QJSONRPC_INTEGER_CONVERTER(ushort)
+QJSONRPC_INTEGER_CONVERTER(int)
+QJSONRPC_INTEGER_CONVERTER(uint)
+QJSONRPC_INTEGER_CONVERTER(long)
+QJSONRPC_INTEGER_CONVERTER(ulong)
+QJSONRPC_INTEGER_CONVERTER(qlonglong)
+QJSONRPC_INTEGER_CONVERTER(qulonglong)
+#undef QJSONRPC_INTEGER_CONVERTER
+
+template <>
+struct QJsonRpcTypeConverter<float>
+{
+    static bool fromJson(const QJsonValue &value, float *out) {
+        if (!value.isDouble())
+            return false;
+        const double number = value.toDouble();
+        if (number > std::numeric_limits<float>::max() || number < -std::numeric_limits<float>::max())
+            return false;
+        *out = static_cast<float>(number);
+        return true;
+    }
+
+    static QJsonValue toJson(float value) { return QJsonValue(static_cast<double>(value)); }
+};
+
+template <>
+struct QJsonRpcTypeConverter<double>
+{
+    static bool fromJson(const QJsonValue &value, double *out) {
+        if (!value.isDouble())
+            return false;
+        *out = value.toDouble();
+        return true;
+    }
+
+    static QJsonValue toJson(double value) { return QJsonValue(value); }
+};
+
+template <>
+struct QJsonRpcTypeConverter<bool>
+{
+    static bool fromJson(const QJsonValue &value, bool *out) {
+        if (!value.isBool())
+            return false;
+        *out = value.toBool();
+        return true;
+    }
+
+    static QJsonValue toJson(bool value) { return QJsonValue(value); }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QString>
+{
+    static bool fromJson(const QJsonValue &value, QString *out) {
+        if (!value.isString())
+            return false;
+        *out = value.toString();
+        return true;
+    }
+
+    static QJsonValue toJson(const QString &value) { return QJsonValue(value); }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QStringList>
+{
+    static bool fromJson(const QJsonValue &value, QStringList *out) {
+        if (!value.isArray())
+            return false;
+        const QJsonArray array = value.toArray();
+        out->reserve(array.size());
+        for (int i = 0; i < array.size(); ++i) {
+            if (!array.at(i).isString())
+                return false;
+            out->append(array.at(i).toString());
+        }
+        return true;
+    }
+
+    static QJsonValue toJson(const QStringList &value) {
+        QJsonArray array;
+        for (int i = 0; i < value.size(); ++i)
+            array.append(value.at(i));
+        return array;
+    }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QJsonValue>
+{
+    static bool fromJson(const QJsonValue &value, QJsonValue *out) {
+        *out = value;
+        return true;
+    }
+
+    static QJsonValue toJson(const QJsonValue &value) { return value; }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QJsonArray>
+{
+    static bool fromJson(const QJsonValue &value, QJsonArray *out) {
+        if (!value.isArray())
+            return false;
+        *out = value.toArray();
+        return true;
+    }
+
+    static QJsonValue toJson(const QJsonArray &value) { return value; }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QJsonObject>
+{
+    static bool fromJson(const QJsonValue &value, QJsonObject *out) {
+        if (!value.isObject())
+            return false;
+        *out = value.toObject();
+        return true;
+    }
+
+    static QJsonValue toJson(const QJsonObject &value) { return value; }
+};
+
+template <>
+struct QJsonRpcTypeConverter<QVariant>
+{
+    static bool fromJson(const QJsonValue &value, QVariant *out) {
+        *out = value.toVariant();
+        return true;
+    }
+
+    static QJsonValue toJson(const QVariant &value) { return QJsonValue::fromVariant(value); }
+};
+
+// arguments are taken by value or const reference
+template <typename T>
+struct QJsonRpcArgument { typedef T Type; };
+template <typename T>
+struct QJsonRpcArgument<const T &> { typedef T Type; };
+
+// never defined: registering a method with an argument taken by non-const
+// reference fails on the incomplete type below, which names the argument
+template <typename T>
+struct QJsonRpcNonConstReferenceArgumentsAreNotSupported;
+template <typename T>
+struct QJsonRpcArgument<T &>
+{
+    enum { Check = sizeof(QJsonRpcNonConstReferenceArgumentsAreNotSupported<T>) };
+    typedef T Type;
+};
+
+#define QJSONRPC_CONVERT_ARGUMENT(N) \
+    typename QJsonRpcArgument<A##N>::Type a##N = typename QJsonRpcArgument<A##N>::Type(); \
+    if (!QJsonRpcTypeConverter<typename QJsonRpcArgument<A##N>::Type>::fromJson(arguments[N - 1], &a##N)) \
+        return N - 1;
+
+class QJsonRpcService;
+class QJSONRPC_EXPORT QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker(int argumentCount, const QStringList &parameterNames);
+    virtual ~QJsonRpcMethodInvoker();
+
+    int argumentCount() const;
+    enum { MaxArguments = 4 };
+
+    // on failure returns false with an error message set
+    bool invoke(QJsonRpcService *service, const QJsonValue &params,
+                QJsonValue *result, QString *errorMessage) const;
+
+protected:
+    // arguments holds argumentCount() values, taken from the params array or
+    // object as they are. Returns the index of an argument that does not
+    // convert, -1 on success
+    virtual int call(QJsonRpcService *service, const QJsonValue *arguments,
+                     QJsonValue *result) const = 0;
+
+private:
+    int m_argumentCount;
+    QStringList m_parameterNames;
+};
+
+template <typename F, typename R, typename C>
+class QJsonRpcMethodInvoker0 : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker0(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(0, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *, QJsonValue *result) const {
+        *result = QJsonRpcTypeConverter<typename QJsonRpcArgument<R>::Type>::toJson((static_cast<C*>(service)->*m_method)());
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename C>
+class QJsonRpcMethodInvoker0<F, void, C> : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker0(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(0, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *, QJsonValue *result) const {
+        (static_cast<C*>(service)->*m_method)();
+        *result = QJsonValue();
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename R, typename C, typename A1>
+class QJsonRpcMethodInvoker1 : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker1(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(1, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *arguments, QJsonValue *result) const {
+        QJSONRPC_CONVERT_ARGUMENT(1)
+        *result = QJsonRpcTypeConverter<typename QJsonRpcArgument<R>::Type>::toJson((static_cast<C*>(service)->*m_method)(a1));
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename C, typename A1>
+class QJsonRpcMethodInvoker1<F, void, C, A1> : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker1(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(1, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *arguments, QJsonValue *result) const {
+        QJSONRPC_CONVERT_ARGUMENT(1)
+        (static_cast<C*>(service)->*m_method)(a1);
+        *result = QJsonValue();
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename R, typename C, typename A1, typename A2>
+class QJsonRpcMethodInvoker2 : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker2(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(2, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *arguments, QJsonValue *result) const {
+        QJSONRPC_CONVERT_ARGUMENT(1)
+        QJSONRPC_CONVERT_ARGUMENT(2)
+        *result = QJsonRpcTypeConverter<typename QJsonRpcArgument<R>::Type>::toJson((static_cast<C*>(service)->*m_method)(a1, a2));
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename C, typename A1, typename A2>
+class QJsonRpcMethodInvoker2<F, void, C, A1, A2> : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker2(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(2, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *arguments, QJsonValue *result) const {
+        QJSONRPC_CONVERT_ARGUMENT(1)
+        QJSONRPC_CONVERT_ARGUMENT(2)
+        (static_cast<C*>(service)->*m_method)(a1, a2);
+        *result = QJsonValue();
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename R, typename C, typename A1, typename A2, typename A3>
+class QJsonRpcMethodInvoker3 : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker3(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(3, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *arguments, QJsonValue *result) const {
+        QJSONRPC_CONVERT_ARGUMENT(1)
+        QJSONRPC_CONVERT_ARGUMENT(2)
+        QJSONRPC_CONVERT_ARGUMENT(3)
+        *result = QJsonRpcTypeConverter<typename QJsonRpcArgument<R>::Type>::toJson((static_cast<C*>(service)->*m_method)(a1, a2, a3));
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename C, typename A1, typename A2, typename A3>
+class QJsonRpcMethodInvoker3<F, void, C, A1, A2, A3> : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker3(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(3, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *arguments, QJsonValue *result) const {
+        QJSONRPC_CONVERT_ARGUMENT(1)
+        QJSONRPC_CONVERT_ARGUMENT(2)
+        QJSONRPC_CONVERT_ARGUMENT(3)
+        (static_cast<C*>(service)->*m_method)(a1, a2, a3);
+        *result = QJsonValue();
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename R, typename C, typename A1, typename A2, typename A3, typename A4>
+class QJsonRpcMethodInvoker4 : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker4(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(4, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *arguments, QJsonValue *result) const {
+        QJSONRPC_CONVERT_ARGUMENT(1)
+        QJSONRPC_CONVERT_ARGUMENT(2)
+        QJSONRPC_CONVERT_ARGUMENT(3)
+        QJSONRPC_CONVERT_ARGUMENT(4)
+        *result = QJsonRpcTypeConverter<typename QJsonRpcArgument<R>::Type>::toJson((static_cast<C*>(service)->*m_method)(a1, a2, a3, a4));
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+template <typename F, typename C, typename A1, typename A2, typename A3, typename A4>
+class QJsonRpcMethodInvoker4<F, void, C, A1, A2, A3, A4> : public QJsonRpcMethodInvoker
+{
+public:
+    QJsonRpcMethodInvoker4(F method, const QStringList &names)
+        : QJsonRpcMethodInvoker(4, names), m_method(method) {}
+
+protected:
+    int call(QJsonRpcService *service, const QJsonValue *arguments, QJsonValue *result) const {
+        QJSONRPC_CONVERT_ARGUMENT(1)
+        QJSONRPC_CONVERT_ARGUMENT(2)
+        QJSONRPC_CONVERT_ARGUMENT(3)
+        QJSONRPC_CONVERT_ARGUMENT(4)
+        (static_cast<C*>(service)->*m_method)(a1, a2, a3, a4);
+        *result = QJsonValue();
+        return -1;
+    }
+
+private:
+    F m_method;
+};
+
+#undef QJSONRPC_CONVERT_ARGUMENT
+
+#endif
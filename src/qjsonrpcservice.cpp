@@ -17,6 +17,9 @@
 #include <QVarLengthArray>
 #include <QMetaMethod>
 #include <QEventLoop>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QThreadStorage>
 #include <QDebug>
 
 #include "qjsonrpcsocket.h"
@@ -26,20 +29,91 @@
 QJsonRpcService::QJsonRpcService(QObject *parent)
     : QObject(*new QJsonRpcServicePrivate(this), parent)
 {
+    connect(this, SIGNAL(result(QJsonRpcMessage)),
+            this, SLOT(_q_forwardResult(QJsonRpcMessage)), Qt::DirectConnection);
 }
 
 QJsonRpcService::~QJsonRpcService()
 {
+    // a no-op once the provider drained it, only guards our own members
+    Q_D(QJsonRpcService);
+    d->waitForInvocations();
+}
+
+QThreadPool *QJsonRpcService::threadPool() const
+{
+    Q_D(const QJsonRpcService);
+    return d->threadPool;
+}
+
+void QJsonRpcService::setThreadPool(QThreadPool *pool)
+{
+    Q_D(QJsonRpcService);
+    d->threadPool = pool;
+}
+
+void QJsonRpcService::waitForInvocations()
+{
+    Q_D(QJsonRpcService);
+    d->waitForInvocations();
+}
+
+int QJsonRpcService::resolvedMethodCacheHits() const
+{
+    Q_D(const QJsonRpcService);
+#if QT_VERSION >= 0x050000
+    return d->resolvedMethodCacheHits.load();
+#else
+    return d->resolvedMethodCacheHits;
+#endif
+}
+
+int QJsonRpcService::resolvedMethodCacheMisses() const
+{
+    Q_D(const QJsonRpcService);
+#if QT_VERSION >= 0x050000
+    return d->resolvedMethodCacheMisses.load();
+#else
+    return d->resolvedMethodCacheMisses;
+#endif
+}
+
+void QJsonRpcService::registerInvoker(const QByteArray &name, QJsonRpcMethodInvoker *invoker)
+{
+    Q_D(QJsonRpcService);
+    delete d->registeredMethods.take(name);
+    d->registeredMethods.insert(name, invoker);
 }
 
 QJsonRpcSocket *QJsonRpcService::senderSocket()
 {
     Q_D(QJsonRpcService);
-    if (d->socket)
-        return d->socket.data();
+    QJsonRpcServiceRequest *request = d->currentRequest();
+    if (request)
+        return request->socket();
     return 0;
 }
 
+QJsonRpcServiceRequest QJsonRpcService::currentRequest() const
+{
+    Q_D(const QJsonRpcService);
+    QJsonRpcServiceRequest *request = d->currentRequest();
+    if (request)
+        return *request;
+    return QJsonRpcServiceRequest();
+}
+
+QJsonRpcServiceRequest QJsonRpcService::beginDelayedResponse()
+{
+    Q_D(QJsonRpcService);
+    if (!d->setCurrentRequestDelayed()) {
+        qDebug() << Q_FUNC_INFO << "called outside of a request";
+        return QJsonRpcServiceRequest();
+    }
+
+    return *d->currentRequest();
+}
+
 int convertVariantTypeToJSType(int type)
 {
     switch (type) {
@@ -73,10 +147,255 @@ int convertVariantTypeToJSType(int type)
 }
 
 int QJsonRpcServicePrivate::qjsonRpcMessageType = qRegisterMetaType<QJsonRpcMessage>("QJsonRpcMessage");
+// the request being processed in the current thread
+struct QJsonRpcCurrentRequest
+{
+    QJsonRpcCurrentRequest() : service(0), request(0), delayed(false) {}
+    const QJsonRpcServicePrivate *service;
+    QJsonRpcServiceRequest *request;
+    bool delayed;
+};
+typedef QThreadStorage<QJsonRpcCurrentRequest*> QJsonRpcCurrentRequestStorage;
+Q_GLOBAL_STATIC(QJsonRpcCurrentRequestStorage, currentRequestStorage)
+
+static QJsonRpcCurrentRequest *currentRequestSlot()
+{
+    QJsonRpcCurrentRequestStorage *storage = currentRequestStorage();
+    if (!storage)
+        return 0;
+    if (!storage->hasLocalData())
+        storage->setLocalData(new QJsonRpcCurrentRequest);
+    return storage->localData();
+}
+
+// makes a request current while its method runs, restores the outer one after
+class QJsonRpcCurrentRequestScope
+{
+public:
+    QJsonRpcCurrentRequestScope(QJsonRpcServicePrivate *service, QJsonRpcServiceRequest *request)
+        : slot(currentRequestSlot())
+    {
+        if (slot) {
+            previous = *slot;
+            slot->service = service;
+            slot->request = request;
+            slot->delayed = false;
+        }
+    }
+
+    bool isDelayed() const { return slot && slot->delayed; }
+
+    ~QJsonRpcCurrentRequestScope()
+    {
+        if (slot)
+            *slot = previous;
+    }
+
+private:
+    QJsonRpcCurrentRequest *slot;
+    QJsonRpcCurrentRequest previous;
+};
+
+QJsonRpcServiceRequest *QJsonRpcServicePrivate::currentRequest() const
+{
+    QJsonRpcCurrentRequest *slot = currentRequestSlot();
+    if (!slot || slot->service != this)
+        return 0;
+    return slot->request;
+}
+
+bool QJsonRpcServicePrivate::setCurrentRequestDelayed()
+{
+    QJsonRpcCurrentRequest *slot = currentRequestSlot();
+    if (!slot || slot->service != this || !slot->request)
+        return false;
+    slot->delayed = true;
+    return true;
+}
+
+void QJsonRpcServicePrivate::processRequest(const QJsonRpcServiceRequest &request)
+{
+    QJsonRpcServiceRequest current(request);
+
+    // waited too long for a pooled thread or the service's own one
+    if (current.hasExpired()) {
+        if (current.request().type() == QJsonRpcMessage::Request)
+            current.respond(current.request().createErrorResponse(QJsonRpc::TimeoutError,
+                                                                  "request expired"));
+        return;
+    }
+
+    QJsonRpcCurrentRequestScope scope(this, &current);
+    QJsonRpcMessage response = invoke(current.request(), current.methodName());
+
+    // a slot that called beginDelayedResponse() or emitted result() answers on its own
+    if (!scope.isDelayed() && !current.hasResponded())
+        current.respond(response);
+}
+
+void QJsonRpcServicePrivate::_q_forwardResult(const QJsonRpcMessage &response)
+{
+    QJsonRpcServiceRequest *request = currentRequest();
+    if (request && !request->hasResponded())
+        request->respond(response);
+}
+
+void QJsonRpcServicePrivate::queueRequest(const QJsonRpcServiceRequest &request)
+{
+    Q_Q(QJsonRpcService);
+    QMutexLocker locker(&queuedRequestsMutex);
+    queuedRequests.append(request);
+    if (queuedRequests.size() == 1)
+        QMetaObject::invokeMethod(q, "_q_processQueuedRequests", Qt::QueuedConnection);
+}
+
+void QJsonRpcServicePrivate::_q_processQueuedRequests()
+{
+    QMutexLocker locker(&queuedRequestsMutex);
+    QList<QJsonRpcServiceRequest> requests = queuedRequests;
+    queuedRequests.clear();
+    locker.unlock();
+
+    for (int i = 0; i < requests.size(); ++i) {
+        // skip clients that went away in the meantime
+        if (requests.at(i).socket())
+            processRequest(requests.at(i));
+    }
+}
+
+void QJsonRpcServiceInvocation::run()
+{
+    service->processRequest(request);
+    service->finishInvocation();
+}
+
+void QJsonRpcServicePrivate::startInvocation(const QJsonRpcServiceRequest &request)
+{
+    QMutexLocker locker(&invocationsMutex);
+    activeInvocations++;
+    locker.unlock();
+    threadPool->start(new QJsonRpcServiceInvocation(this, request));
+}
+
+void QJsonRpcServicePrivate::finishInvocation()
+{
+    QMutexLocker locker(&invocationsMutex);
+    if (--activeInvocations == 0)
+        invocationsDone.wakeAll();
+}
+
+void QJsonRpcServicePrivate::waitForInvocations()
+{
+    QMutexLocker locker(&invocationsMutex);
+    while (activeInvocations > 0)
+        invocationsDone.wait(&invocationsMutex);
+}
+
+QJsonRpcArgumentFrame::QJsonRpcArgumentFrame(const QJsonRpcServicePrivate::MethodInfo &info)
+    : info(info)
+{
+    const int count = info.params.size() + 1;
+    values.resize(count);
+#if QT_VERSION >= 0x050000
+    storage = info.frameSize <= InlineSize ? inlineStorage
+                                           : static_cast<char *>(::malloc(info.frameSize));
+    char *slot = storage;
+    for (int i = 0; i < count; ++i) {
+        const int t = type(i);
+        if (t == QMetaType::Void) {
+            values[i] = 0;
+            continue;
+        }
+        if (t >= QMetaType::User) {
+            values[i] = QMetaType::create(t, 0);
+            continue;
+        }
+        values[i] = QMetaType::construct(t, slot, 0);
+        slot += slotSize(t);
+    }
+#else
+    variants.resize(count);
+    for (int i = 0; i < count; ++i) {
+        const int t = type(i);
+        if (t == QMetaType::Void)
+            values[i] = 0;
+        else if (t == QMetaType::QVariant)
+            values[i] = &variants[i];
+        else {
+            variants[i] = QVariant(t, static_cast<const void *>(0));
+            values[i] = variants[i].data();
+        }
+    }
+#endif
+}
+
+QJsonRpcArgumentFrame::~QJsonRpcArgumentFrame()
+{
+#if QT_VERSION >= 0x050000
+    for (int i = 0; i < values.size(); ++i) {
+        const int t = type(i);
+        if (!values[i])
+            continue;
+        if (t >= QMetaType::User)
+            QMetaType::destroy(t, values[i]);
+        else
+            QMetaType::destruct(t, values[i]);
+    }
+    if (storage != inlineStorage)
+        ::free(storage);
+#endif
+}
+
+/*
+ * Bytes a value of type takes in the frame, kept at 8 byte alignment. That
+ * is enough for the built-in types only: registered user types may need
+ * more, and are allocated on their own by QMetaType::create like Qt does.
+ */
+int QJsonRpcArgumentFrame::slotSize(int type)
+{
+#if QT_VERSION >= 0x050000
+    if (type == QMetaType::Void || type >= QMetaType::User)
+        return 0;
+    return (QMetaType::sizeOf(type) + 7) & ~7;
+#else
+    Q_UNUSED(type)
+    return 0;
+#endif
+}
+
+int QJsonRpcArgumentFrame::type(int index) const
+{
+    return index == 0 ? info.retType : info.params.at(index - 1).type;
+}
+
+void QJsonRpcArgumentFrame::setValue(int index, const void *copy)
+{
+    const int t = type(index);
+#if QT_VERSION >= 0x050000
+    QMetaType::destruct(t, values[index]);
+    QMetaType::construct(t, values[index], copy);
+#else
+    if (t == QMetaType::QVariant) {
+        variants[index] = *static_cast<const QVariant *>(copy);
+    } else {
+        variants[index] = QVariant(t, copy);
+        values[index] = variants[index].data();
+    }
+#endif
+}
+
 void QJsonRpcServicePrivate::cacheInvokableInfo()
 {
     Q_Q(QJsonRpcService);
     const QMetaObject *obj = q->metaObject();
+    int concurrencyIndex = obj->indexOfClassInfo("concurrency");
+    if (concurrencyIndex != -1 && !threadPool) {
+        if (qstrcmp(obj->classInfo(concurrencyIndex).value(), "threadpool") == 0)
+            threadPool = QThreadPool::globalInstance();
+        else
+            qDebug() << Q_FUNC_INFO << "unknown concurrency" << obj->classInfo(concurrencyIndex).value();
+    }
+
     int startIdx = q->staticMetaObject.methodCount(); // skip QObject slots
     for (int idx = startIdx; idx < obj->methodCount(); ++idx) {
         const QMetaMethod method = obj->method(idx);
@@ -142,6 +461,17 @@ void QJsonRpcServicePrivate::cacheInvokableInfo()
             if (methodName.isEmpty())
                 continue;
 
+            for (int i = 0; i < info.params.size(); ++i) {
+                int j = info.sortedParams.size();
+                while (j > 0 && info.params.at(i).name < info.params.at(info.sortedParams.at(j - 1)).name)
+                    --j;
+                info.sortedParams.insert(j, i);
+            }
+
+            info.frameSize = QJsonRpcArgumentFrame::slotSize(info.retType);
+            for (int i = 0; i < info.params.size(); ++i)
+                info.frameSize += QJsonRpcArgumentFrame::slotSize(info.params.at(i).type);
+
             if (signature.contains("QVariant"))
                 invokableMethodHash[methodName].append(idx);
             else
@@ -169,34 +499,224 @@ static bool jsParamCompare(const QJsonArray &params, const QJsonRpcServicePrivat
     return (j == params.size());
 }
 
-static bool jsParamCompare(const QJsonObject &params, const QJsonRpcServicePrivate::MethodInfo &info)
+/*
+ * Matches params against info in one pass over both, the object's keys and
+ * the method's sortedParams being in the same order. positions receives the
+ * index into params of every parameter, -1 for missing ones.
+ */
+static bool jsParamCompare(const QJsonObject &params, const QJsonRpcServicePrivate::MethodInfo &info,
+                           QList<int> *positions)
 {
+    positions->clear();
     for (int i = 0; i < info.params.size(); ++i)
-    {
-        int jsType = info.params.at(i).jsType;
-        QJsonValue value = params.value(info.params.at(i).name);
-        if (value == QJsonValue::Undefined)
-        {
-            if (!info.params.at(i).out)
+        positions->append(-1);
+
+    int next = 0;
+    int position = 0;
+    for (QJsonObject::const_iterator it = params.constBegin();
+         it != params.constEnd() && next < info.sortedParams.size(); ++it, ++position) {
+        const QString key = it.key();
+        while (next < info.sortedParams.size() &&
+               info.params.at(info.sortedParams.at(next)).name < key)
+            ++next;
+
+        // unnamed parameters all share the empty name
+        while (next < info.sortedParams.size()) {
+            const int index = info.sortedParams.at(next);
+            const QJsonRpcServicePrivate::ParamInfo &param = info.params.at(index);
+            if (param.name != key)
+                break;
+            if (param.jsType != QJsonValue::Undefined && param.jsType != it.value().type())
                 return false;
+            (*positions)[index] = position;
+            ++next;
         }
-        else if (jsType == QJsonValue::Undefined)
-            continue;
-        else if (jsType != value.type())
+    }
+
+    for (int i = 0; i < info.params.size(); ++i)
+    {
+        if (positions->at(i) == -1 && !info.params.at(i).out)
             return false;
     }
     return true;
 }
 
+/*
+ * Built-in types read from and written to json without going through QVariant.
+ */
+static inline bool isDirectType(int type)
+{
+    switch (type) {
+    case QMetaType::Bool:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Double:
+    case QMetaType::QString:
+    case QMetaType::QStringList:
+    case QMetaType::QVariantList:
+    case QMetaType::QVariantMap:
+#if QT_VERSION >= 0x050000
+    case QMetaType::QJsonValue:
+    case QMetaType::QJsonObject:
+    case QMetaType::QJsonArray:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Writes val into data, an already constructed object of type. Returns
+ * ArgumentMismatch when val doesn't hold that type, leaving the generic
+ * conversion to decide. Numbers are rounded like QVariant::convert does,
+ * those out of the type's range are refused instead of wrapped.
+ */
+enum ArgumentWrite {
+    ArgumentWritten,
+    ArgumentMismatch,
+    ArgumentOutOfRange
+};
+
+template <typename T>
+static inline ArgumentWrite writeInteger(const QJsonValue &val, void *data)
+{
+    if (!val.isDouble())
+        return ArgumentMismatch;
+    if (!qjsonRpcNumberToInteger(val.toDouble(), static_cast<T *>(data)))
+        return ArgumentOutOfRange;
+    return ArgumentWritten;
+}
+
+static inline ArgumentWrite writeArgument(const QJsonValue &val, int type, void *data)
+{
+    switch (type) {
+    case QMetaType::Bool:
+        if (!val.isBool())
+            return ArgumentMismatch;
+        *static_cast<bool *>(data) = val.toBool();
+        return ArgumentWritten;
+    case QMetaType::Int:
+        return writeInteger<int>(val, data);
+    case QMetaType::UInt:
+        return writeInteger<uint>(val, data);
+    case QMetaType::LongLong:
+        return writeInteger<qlonglong>(val, data);
+    case QMetaType::ULongLong:
+        return writeInteger<qulonglong>(val, data);
+    case QMetaType::Double:
+        if (!val.isDouble())
+            return ArgumentMismatch;
+        *static_cast<double *>(data) = val.toDouble();
+        return ArgumentWritten;
+    case QMetaType::QString:
+        if (!val.isString())
+            return ArgumentMismatch;
+        *static_cast<QString *>(data) = val.toString();
+        return ArgumentWritten;
+    case QMetaType::QStringList: {
+        if (!val.isArray())
+            return ArgumentMismatch;
+        const QJsonArray array = val.toArray();
+        QStringList *list = static_cast<QStringList *>(data);
+        list->reserve(array.size());
+        for (int i = 0; i < array.size(); ++i) {
+            if (!array.at(i).isString()) {
+                list->clear();
+                return ArgumentMismatch;
+            }
+            list->append(array.at(i).toString());
+        }
+        return ArgumentWritten;
+    }
+    case QMetaType::QVariantList:
+        if (!val.isArray())
+            return ArgumentMismatch;
+        *static_cast<QVariantList *>(data) = val.toArray().toVariantList();
+        return ArgumentWritten;
+    case QMetaType::QVariantMap:
+        if (!val.isObject())
+            return ArgumentMismatch;
+        *static_cast<QVariantMap *>(data) = val.toObject().toVariantMap();
+        return ArgumentWritten;
+#if QT_VERSION >= 0x050000
+    case QMetaType::QJsonValue:
+        *static_cast<QJsonValue *>(data) = val;
+        return ArgumentWritten;
+    case QMetaType::QJsonObject:
+        if (!val.isObject())
+            return ArgumentMismatch;
+        *static_cast<QJsonObject *>(data) = val.toObject();
+        return ArgumentWritten;
+    case QMetaType::QJsonArray:
+        if (!val.isArray())
+            return ArgumentMismatch;
+        *static_cast<QJsonArray *>(data) = val.toArray();
+        return ArgumentWritten;
+#endif
+    default:
+        return ArgumentMismatch;
+    }
+}
+
+/*
+ * Reads a return value of type from data, false for types that need QVariant.
+ */
+static inline bool readReturnValue(int type, const void *data, QJsonValue *out)
+{
+    switch (type) {
+    case QMetaType::Void:
+        *out = QJsonValue();
+        return true;
+    case QMetaType::Bool:
+        *out = QJsonValue(*static_cast<const bool *>(data));
+        return true;
+    case QMetaType::Int:
+        *out = QJsonValue(*static_cast<const int *>(data));
+        return true;
+    case QMetaType::UInt:
+        *out = QJsonValue(double(*static_cast<const uint *>(data)));
+        return true;
+    case QMetaType::LongLong:
+        *out = QJsonValue(double(*static_cast<const qlonglong *>(data)));
+        return true;
+    case QMetaType::ULongLong:
+        *out = QJsonValue(double(*static_cast<const qulonglong *>(data)));
+        return true;
+    case QMetaType::Double:
+        *out = QJsonValue(*static_cast<const double *>(data));
+        return true;
+    case QMetaType::QString:
+        *out = QJsonValue(*static_cast<const QString *>(data));
+        return true;
+    case QMetaType::QStringList:
+        *out = QJsonArray::fromStringList(*static_cast<const QStringList *>(data));
+        return true;
+#if QT_VERSION >= 0x050000
+    case QMetaType::QJsonValue:
+        *out = *static_cast<const QJsonValue *>(data);
+        return true;
+    case QMetaType::QJsonObject:
+        *out = *static_cast<const QJsonObject *>(data);
+        return true;
+    case QMetaType::QJsonArray:
+        *out = *static_cast<const QJsonArray *>(data);
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
 /*
  * Convenience function to convert JSonValue to the right type.
  */
-static inline QVariant argumentConvert(
+static inline QVariant variantConvert(
         const QJsonValue &val,
         const QJsonRpcServicePrivate::ParamInfo &info)
 {
-    if (val.isUndefined())
-        return QVariant(info.type, NULL);
 
 #if QT_VERSION >= 0x050200
     if (info.type >= QMetaType::User)
@@ -234,8 +754,48 @@ static inline QVariant argumentConvert(
 #endif
 }
 
-static inline QJsonValue retConvert(QVariant &ret)
+/*
+ * Fills argument index of frame from val, a missing val leaves the default
+ * constructed value in place.
+ */
+static inline bool argumentConvert(const QJsonValue &val,
+                                   const QJsonRpcServicePrivate::ParamInfo &info,
+                                   QJsonRpcArgumentFrame *frame, int index)
+{
+    if (val.isUndefined())
+        return true;
+
+    if (isDirectType(info.type)) {
+        switch (writeArgument(val, info.type, frame->value(index))) {
+        case ArgumentWritten:
+            return true;
+        case ArgumentOutOfRange:
+            return false;
+        case ArgumentMismatch:
+            break;
+        }
+    }
+
+    QVariant arg = variantConvert(val, info);
+    if (!arg.isValid())
+        return false;
+    if (info.type == QMetaType::QVariant)
+        frame->setValue(index, &arg);
+    else if (arg.userType() == info.type)
+        frame->setValue(index, arg.constData());
+    else
+        return false;
+    return true;
+}
+
+static inline QJsonValue retConvert(int type, const void *data)
 {
+    QJsonValue value;
+    if (readReturnValue(type, data, &value))
+        return value;
+
+    QVariant ret = type == QMetaType::QVariant ? *static_cast<const QVariant *>(data)
+                                               : QVariant(type, data);
 #if QT_VERSION >= 0x050200
     switch (ret.type())
     {
@@ -270,157 +830,224 @@ static inline QByteArray methodName(const QJsonRpcMessage &request)
     return methodPath.midRef(methodPath.lastIndexOf('.') + 1).toLatin1();
 }
 
-//QJsonRpcMessage QJsonRpcService::dispatch(const QJsonRpcMessage &request) const
-bool QJsonRpcService::dispatch(const QJsonRpcMessage &request)
+/*
+ * The json types of params, with the names for named parameters, in the
+ * order the overload comparisons see them. Collisions are told apart by
+ * signatureMatches().
+ */
+static uint signatureHash(const QByteArray &method, const QJsonValue &params)
 {
-    Q_D(QJsonRpcService);
-    if (request.type() != QJsonRpcMessage::Request &&
-        request.type() != QJsonRpcMessage::Notification) {
-        QJsonRpcMessage error =
-            request.createErrorResponse(QJsonRpc::InvalidRequest, "invalid request");
-        Q_EMIT result(error);
-        return false;
+    uint hash = qHash(method);
+    if (params.isObject()) {
+        const QJsonObject object = params.toObject();
+        hash = hash * 31 + '{';
+        for (QJsonObject::const_iterator it = object.constBegin(); it != object.constEnd(); ++it)
+            hash = (hash * 31 + qHash(it.key())) * 31 + it.value().type();
+    } else {
+        const QJsonArray array = params.toArray();
+        hash = hash * 31 + '[';
+        for (int i = 0; i < array.size(); ++i)
+            hash = hash * 31 + array.at(i).type();
     }
 
-    const QByteArray &method(methodName(request));
-    if (!d->invokableMethodHash.contains(method)) {
-        QJsonRpcMessage error =
-            request.createErrorResponse(QJsonRpc::MethodNotFound, "invalid method called");
-        Q_EMIT result(error);
+    return hash;
+}
+
+static bool signatureMatches(const QJsonRpcServicePrivate::ResolvedSignature &signature,
+                             const QByteArray &method, const QJsonValue &params)
+{
+    if (signature.method != method || signature.named != params.isObject())
         return false;
+
+    if (signature.named) {
+        const QJsonObject object = params.toObject();
+        if (object.size() != signature.names.size())
+            return false;
+        int i = 0;
+        for (QJsonObject::const_iterator it = object.constBegin(); it != object.constEnd(); ++it, ++i) {
+            if (it.value().type() != signature.types.at(i) || it.key() != signature.names.at(i))
+                return false;
+        }
+    } else {
+        const QJsonArray array = params.toArray();
+        if (array.size() != signature.types.size())
+            return false;
+        for (int i = 0; i < array.size(); ++i) {
+            if (array.at(i).type() != signature.types.at(i))
+                return false;
+        }
     }
 
-    int idx = -1;
-    QVariantList arguments;
-    const QList<int> &indexes = d->invokableMethodHash.value(method);
-    const QJsonValue &params = request.params();
-    QVarLengthArray<void *, 10> parameters;
-    QVariant returnValue;
-    QMetaType::Type returnType = QMetaType::Void;
+    return true;
+}
+
+static void fillSignature(QJsonRpcServicePrivate::ResolvedSignature *signature,
+                          const QByteArray &method, const QJsonValue &params)
+{
+    signature->method = method;
+    signature->named = params.isObject();
+    if (signature->named) {
+        const QJsonObject object = params.toObject();
+        for (QJsonObject::const_iterator it = object.constBegin(); it != object.constEnd(); ++it) {
+            signature->names.append(it.key());
+            signature->types.append(char(it.value().type()));
+        }
+    } else {
+        const QJsonArray array = params.toArray();
+        for (int i = 0; i < array.size(); ++i)
+            signature->types.append(char(array.at(i).type()));
+    }
+}
+
+/*
+ * Picks the overload of method to call with params. Overloads are matched on
+ * json types alone, so the result is cached per type signature.
+ */
+QJsonRpcServicePrivate::ResolvedMethod QJsonRpcServicePrivate::resolveMethod(
+        const QByteArray &method, const QJsonValue &params)
+{
+    const uint hash = signatureHash(method, params);
+    {
+        QMutexLocker locker(&resolvedMethodsMutex);
+        QHash<uint, ResolvedSignature>::const_iterator it = resolvedMethods.constFind(hash);
+        if (it != resolvedMethods.constEnd() && signatureMatches(it.value(), method, params)) {
+            resolvedMethodCacheHits.ref();
+            return it.value().resolved;
+        }
+    }
 
+    resolvedMethodCacheMisses.ref();
+    ResolvedSignature signature;
+    fillSignature(&signature, method, params);
+    ResolvedMethod &resolved = signature.resolved;
+    const QList<int> &indexes = invokableMethodHash.value(method);
     if (params.isObject()) {
         QJsonObject namedParametersObject = params.toObject();
         foreach (int methodIndex, indexes) {
-            QJsonRpcServicePrivate::MethodInfo &info = d->methods[methodIndex];
-            if (jsParamCompare(namedParametersObject, info)) {
-                idx = methodIndex;
-                arguments.reserve(info.params.size());
-                returnType = static_cast<QMetaType::Type>(info.retType);
-                returnValue = returnType == QMetaType::Void ?
-                                         QVariant() : QVariant(returnType, NULL);
-                if (returnType == QMetaType::QVariant)
-                    parameters.append(&returnValue);
-                else
-                    parameters.append(returnValue.data());
-
-                for (int i = 0; i < info.params.size(); ++i)
-                {
-                    const QJsonRpcServicePrivate::ParamInfo &parInfo(info.params.at(i));
-                    QJsonValue val = namedParametersObject.value(parInfo.name);
-                    QVariant arg = argumentConvert(val, parInfo);
-                    if (!arg.isValid())
-                    {
-                        QString message;
-                        if (!val.isUndefined())
-                            message = QString("failed to construct default '%1' object").arg(parInfo.name);
-                        else
-                            message = QString("failed to convert '%1' object from JSon").arg(parInfo.name);
-                        QJsonRpcMessage error =request.createErrorResponse(
-                                    QJsonRpc::InvalidParams, message);
-                        Q_EMIT result(error);
-                        return false;
-                    }
-                    arguments.push_back(arg);
-                    if (parInfo.type == QMetaType::QVariant)
-                        parameters.append(static_cast<void *>(&arguments.last()));
-                    else
-                        parameters.append(const_cast<void *>(arguments.last().constData()));
-                }
+            if (jsParamCompare(namedParametersObject, *methods.constFind(methodIndex),
+                               &resolved.positions)) {
+                resolved.index = methodIndex;
                 break;
             }
         }
-    }
-    else {
+    } else {
         QJsonArray arrayParameters = params.toArray();
         foreach (int methodIndex, indexes) {
-            QJsonRpcServicePrivate::MethodInfo &info = d->methods[methodIndex];
-            if (jsParamCompare(arrayParameters, info)) {
-                idx = methodIndex;
-                arguments.reserve(info.params.size());
-                returnType = static_cast<QMetaType::Type>(info.retType);
-                returnValue = returnType == QMetaType::Void ?
-                                         QVariant() : QVariant(returnType, NULL);
-                if (returnType == QMetaType::QVariant)
-                    parameters.append(&returnValue);
-                else
-                    parameters.append(returnValue.data());
-                for (int i = 0; i < info.params.size(); ++i)
-                {
-                    const QJsonRpcServicePrivate::ParamInfo &parInfo(info.params.at(i));
-                    QVariant arg = argumentConvert(arrayParameters.at(i),
-                                                   parInfo);
-                    if (!arg.isValid())
-                    {
-                        QString message;
-                        if (arrayParameters.at(i).isUndefined())
-                            message = QString("failed to construct default '%1' object").arg(parInfo.name);
-                        else
-                            message = QString("failed to convert '%1' object from JSon").arg(parInfo.name);
-                        QJsonRpcMessage error =request.createErrorResponse(
-                                    QJsonRpc::InvalidParams, message);
-                        Q_EMIT result(error);
-                        return false;
-                    }
-                    arguments.push_back(arg);
-                    if (parInfo.type == QMetaType::QVariant)
-                        parameters.append(static_cast<void *>(&arguments.last()));
-                    else
-                        parameters.append(const_cast<void *>(arguments.last().constData()));
-                }
+            if (jsParamCompare(arrayParameters, *methods.constFind(methodIndex))) {
+                resolved.index = methodIndex;
                 break;
             }
         }
     }
 
-    if (idx == -1) {
-        QJsonRpcMessage error =
-            request.createErrorResponse(QJsonRpc::InvalidParams, "invalid parameters");
-        Q_EMIT result(error);
-        return false;
+    // signatures come from clients, keep their number bounded; a colliding
+    // signature simply takes the slot over
+    QMutexLocker locker(&resolvedMethodsMutex);
+    if (resolvedMethods.size() >= MaxResolvedMethods)
+        resolvedMethods.clear();
+    resolvedMethods.insert(hash, signature);
+    return resolved;
+}
+
+/*
+ * Resolves and calls the method for request and returns the response, or the
+ * error to send instead. Only reads the method tables, so it may run in any
+ * thread once the service has been added to a provider.
+ */
+QJsonRpcMessage QJsonRpcServicePrivate::invoke(const QJsonRpcMessage &request,
+                                               const QByteArray &routedMethod)
+{
+    Q_Q(QJsonRpcService);
+    if (request.type() != QJsonRpcMessage::Request &&
+        request.type() != QJsonRpcMessage::Notification) {
+        return request.createErrorResponse(QJsonRpc::InvalidRequest, "invalid request");
     }
 
-    QJsonRpcServicePrivate::MethodInfo &info = d->methods[idx];
+    const QByteArray &method(routedMethod.isEmpty() ? methodName(request) : routedMethod);
+    if (!registeredMethods.isEmpty()) {
+        QHash<QByteArray, QJsonRpcMethodInvoker*>::const_iterator registered =
+            registeredMethods.constFind(method);
+        if (registered != registeredMethods.constEnd()) {
+            QJsonValue result;
+            QString errorMessage;
+            if (!registered.value()->invoke(q, request.params(), &result, &errorMessage))
+                return request.createErrorResponse(QJsonRpc::InvalidParams, errorMessage);
+            return request.createResponse(result);
+        }
+    }
 
-    // first argument to metacall is the return value
+    if (!invokableMethodHash.contains(method)) {
+        return request.createErrorResponse(QJsonRpc::MethodNotFound, "invalid method called");
+    }
 
+    const QJsonValue &params = request.params();
+    const ResolvedMethod resolved = resolveMethod(method, params);
+    const int idx = resolved.index;
+    if (idx == -1) {
+        return request.createErrorResponse(QJsonRpc::InvalidParams, "invalid parameters");
+    }
 
+    const QJsonRpcServicePrivate::MethodInfo &info = *methods.constFind(idx);
+    QJsonRpcArgumentFrame frame(info);
+    if (params.isObject()) {
+        // the signature placed every parameter already, no lookups by name
+        QJsonObject namedParametersObject = params.toObject();
+        const QJsonObject::const_iterator begin = namedParametersObject.constBegin();
+        for (int i = 0; i < info.params.size(); ++i)
+        {
+            const QJsonRpcServicePrivate::ParamInfo &parInfo(info.params.at(i));
+            const int position = resolved.positions.at(i);
+            const QJsonValue val = position == -1 ? QJsonValue(QJsonValue::Undefined)
+                                                  : (begin + position).value();
+            if (!argumentConvert(val, parInfo, &frame, i + 1)) {
+                QString message = QString("failed to convert '%1' object from JSon").arg(parInfo.name);
+                return request.createErrorResponse(QJsonRpc::InvalidParams, message);
+            }
+        }
+    }
+    else {
+        QJsonArray arrayParameters = params.toArray();
+        for (int i = 0; i < info.params.size(); ++i)
+        {
+            const QJsonRpcServicePrivate::ParamInfo &parInfo(info.params.at(i));
+            if (!argumentConvert(arrayParameters.at(i), parInfo, &frame, i + 1)) {
+                QString message = QString("failed to convert '%1' object from JSon").arg(parInfo.name);
+                return request.createErrorResponse(QJsonRpc::InvalidParams, message);
+            }
+        }
+    }
 
+    // first argument to metacall is the return value
     bool success =
-        const_cast<QJsonRpcService*>(this)->qt_metacall(QMetaObject::InvokeMetaMethod, idx, parameters.data()) < 0;
+        q->qt_metacall(QMetaObject::InvokeMetaMethod, idx, frame.data()) < 0;
     if (!success) {
         QString message = QString("dispatch for method '%1' failed").arg(method.constData());
-        QJsonRpcMessage error =
-            request.createErrorResponse(QJsonRpc::InvalidRequest, message);
-        Q_EMIT result(error);
-        return false;
+        return request.createErrorResponse(QJsonRpc::InvalidRequest, message);
     }
     else if (info.hasOut)
     {
         QJsonArray ret;
         if (info.retType != QMetaType::Void)
-            ret.append(retConvert(returnValue));
+            ret.append(retConvert(info.retType, frame.value(0)));
         for (int i = 0; i < info.params.size(); ++i)
             if (info.params.at(i).out)
-                ret.append(retConvert(arguments[i]));
+                ret.append(retConvert(info.params.at(i).type, frame.value(i + 1)));
         if (ret.size() > 1)
-            Q_EMIT result(request.createResponse(ret));
-        else
-            Q_EMIT result(request.createResponse(ret.first()));
-        return true;
+            return request.createResponse(ret);
+        return request.createResponse(ret.first());
     }
     else
     {
-        Q_EMIT result(request.createResponse(retConvert(returnValue)));
-        return true;
+        return request.createResponse(retConvert(info.retType, frame.value(0)));
     }
 }
+
+bool QJsonRpcService::dispatch(const QJsonRpcMessage &request)
+{
+    Q_D(QJsonRpcService);
+    QJsonRpcMessage response = d->invoke(request);
+    Q_EMIT result(response);
+    return response.type() != QJsonRpcMessage::Error;
+}
+
+#include "moc_qjsonrpcservice.cpp"
@@ -19,7 +19,10 @@
 
 #include <QVariant>
 #include "qjsonrpcmessage.h"
+#include "qjsonrpcservicerequest.h"
+#include "qjsonrpcmethod.h"
 
+class QThreadPool;
 class QJsonRpcSocket;
 class QJsonRpcServiceProvider;
 class QJsonRpcServicePrivate;
@@ -30,21 +33,127 @@ public:
     explicit QJsonRpcService(QObject *parent = 0);
     ~QJsonRpcService();
 
+    // run requests on pool rather than in the service's thread, its slots must
+    // then be safe to call concurrently. Q_CLASSINFO("concurrency", "threadpool")
+    // does the same with QThreadPool::globalInstance()
+    QThreadPool *threadPool() const;
+    void setThreadPool(QThreadPool *pool);
+
+    // blocks until the requests running on the thread pool are done. Providers
+    // do this in removeService() and when they are destroyed, so remove a
+    // pooled service before deleting it, or leave it to its provider
+    void waitForInvocations();
+
+    // calls whose overload was taken from, or had to be added to, the cache
+    // of methods resolved by name and parameter types
+    int resolvedMethodCacheHits() const;
+    int resolvedMethodCacheMisses() const;
+
 Q_SIGNALS:
+    // emitted by a slot while it handles a request, answers that request
+    // instead of the slot's return value
     void result(const QJsonRpcMessage &result);
     void notifyConnectedClients(const QJsonRpcMessage &message);
     void notifyConnectedClients(const QString &method, const QJsonArray &params = QJsonArray());
+    void notifySubscribers(const QString &topic, const QJsonRpcMessage &message);
+    void notifySubscribers(const QString &topic, const QString &method,
+                           const QJsonArray &params = QJsonArray());
 
 protected:
     QJsonRpcSocket *senderSocket();
 
+    // the request the calling slot is answering, invalid outside of one
+    QJsonRpcServiceRequest currentRequest() const;
+
+    // the slot's return value is not sent, answer the returned request later
+    // with QJsonRpcServiceRequest::respond() instead, from any thread
+    QJsonRpcServiceRequest beginDelayedResponse();
+
+    // methods called without QVariant or qt_metacall, argument and return types
+    // are converted as given in qjsonrpcmethod.h. Call these from the constructor,
+    // a registered method hides slots of the same name
+    template <typename R, typename C>
+    void registerMethod(const char *name, R (C::*method)(),
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker0<R (C::*)(), R, C>(method, parameterNames));
+    }
+
+    template <typename R, typename C>
+    void registerMethod(const char *name, R (C::*method)() const,
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker0<R (C::*)() const, R, C>(method, parameterNames));
+    }
+
+    template <typename R, typename C, typename A1>
+    void registerMethod(const char *name, R (C::*method)(A1),
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker1<R (C::*)(A1), R, C, A1>(method, parameterNames));
+    }
+
+    template <typename R, typename C, typename A1>
+    void registerMethod(const char *name, R (C::*method)(A1) const,
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker1<R (C::*)(A1) const, R, C, A1>(method, parameterNames));
+    }
+
+    template <typename R, typename C, typename A1, typename A2>
+    void registerMethod(const char *name, R (C::*method)(A1, A2),
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker2<R (C::*)(A1, A2), R, C, A1, A2>(method, parameterNames));
+    }
+
+    template <typename R, typename C, typename A1, typename A2>
+    void registerMethod(const char *name, R (C::*method)(A1, A2) const,
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker2<R (C::*)(A1, A2) const, R, C, A1, A2>(method, parameterNames));
+    }
+
+    template <typename R, typename C, typename A1, typename A2, typename A3>
+    void registerMethod(const char *name, R (C::*method)(A1, A2, A3),
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker3<R (C::*)(A1, A2, A3), R, C, A1, A2, A3>(method, parameterNames));
+    }
+
+    template <typename R, typename C, typename A1, typename A2, typename A3>
+    void registerMethod(const char *name, R (C::*method)(A1, A2, A3) const,
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker3<R (C::*)(A1, A2, A3) const, R, C, A1, A2, A3>(method, parameterNames));
+    }
+
+    template <typename R, typename C, typename A1, typename A2, typename A3, typename A4>
+    void registerMethod(const char *name, R (C::*method)(A1, A2, A3, A4),
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker4<R (C::*)(A1, A2, A3, A4), R, C, A1, A2, A3, A4>(method, parameterNames));
+    }
+
+    template <typename R, typename C, typename A1, typename A2, typename A3, typename A4>
+    void registerMethod(const char *name, R (C::*method)(A1, A2, A3, A4) const,
+                        const QStringList &parameterNames = QStringList())
+    {
+        registerInvoker(name, new QJsonRpcMethodInvoker4<R (C::*)(A1, A2, A3, A4) const, R, C, A1, A2, A3, A4>(method, parameterNames));
+    }
+
+    void registerInvoker(const QByteArray &name, QJsonRpcMethodInvoker *invoker);
+
 protected Q_SLOTS:
     bool dispatch(const QJsonRpcMessage &request);
 
 private:
     Q_DISABLE_COPY(QJsonRpcService)
     Q_DECLARE_PRIVATE(QJsonRpcService)
+    Q_PRIVATE_SLOT(d_func(), void _q_processQueuedRequests())
+    Q_PRIVATE_SLOT(d_func(), void _q_forwardResult(const QJsonRpcMessage &))
     friend class QJsonRpcServiceProvider;
+    friend class QJsonRpcServiceProviderPrivate;
 
 };
 
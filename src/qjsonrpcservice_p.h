@@ -20,23 +20,82 @@
 #include <private/qobject_p.h>
 
 #include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QRunnable>
 #include <QPointer>
 #include <QVarLengthArray>
+#include <QVariant>
 #include <QStringList>
+#include <QAtomicInt>
 
+#include "qjsonrpcmessage.h"
+#include "qjsonrpcservicerequest.h"
+
+class QThreadPool;
 class QJsonRpcSocket;
 class QJsonRpcService;
+class QJsonRpcServicePrivate;
+class QJsonRpcMethodInvoker;
+
+// a request handed to the service's thread pool
+class QJsonRpcServiceInvocation : public QRunnable
+{
+public:
+    QJsonRpcServiceInvocation(QJsonRpcServicePrivate *service,
+                              const QJsonRpcServiceRequest &request)
+        : service(service),
+          request(request)
+    {
+    }
+
+    virtual void run();
+
+    QJsonRpcServicePrivate *service;
+    QJsonRpcServiceRequest request;
+};
+
 class QJsonRpcServicePrivate : public QObjectPrivate
 {
 public:
     QJsonRpcServicePrivate(QJsonRpcService *parent)
-        : q_ptr(parent)
+        : threadPool(0),
+          activeInvocations(0),
+          q_ptr(parent)
     {
     }
 
+    ~QJsonRpcServicePrivate()
+    {
+        qDeleteAll(registeredMethods);
+    }
+
     void cacheInvokableInfo();
     static int qjsonRpcMessageType;
 
+    // calls the method in the current thread and answers request
+    void processRequest(const QJsonRpcServiceRequest &request);
+    QJsonRpcMessage invoke(const QJsonRpcMessage &request,
+                           const QByteArray &method = QByteArray());
+    struct ResolvedMethod;
+    ResolvedMethod resolveMethod(const QByteArray &method, const QJsonValue &params);
+    QJsonRpcServiceRequest *currentRequest() const;
+    bool setCurrentRequestDelayed();
+
+    // requests received by sockets living in another thread, dispatched
+    // from this service's own thread
+    void queueRequest(const QJsonRpcServiceRequest &request);
+    void _q_processQueuedRequests();
+
+    // result() emitted from a slot, the way services answered by hand before
+    // QJsonRpcServiceRequest
+    void _q_forwardResult(const QJsonRpcMessage &response);
+
+    // requests run on threadPool, see QJsonRpcService::setThreadPool
+    void startInvocation(const QJsonRpcServiceRequest &request);
+    void finishInvocation();
+    void waitForInvocations();
+
     struct ParamInfo
     {
         ParamInfo(int type = 0, int jsType = 0, const QString &name = QString(), bool out = false) :
@@ -52,20 +111,102 @@ public:
     struct MethodInfo
     {
         MethodInfo() :
-            retType(QMetaType::Void), hasOut(false)
+            retType(QMetaType::Void), hasOut(false), frameSize(0)
         {}
 
         QList<ParamInfo> params;
         int retType;
         bool hasOut;
+        int frameSize; /* bytes taken by the return value and arguments */
+        QList<int> sortedParams; /* params indexes ordered by name */
     };
 
     QHash<int, MethodInfo > methods;
     QHash<QByteArray, QList<int> > invokableMethodHash;
-    QPointer<QJsonRpcSocket> socket;
+    QHash<QByteArray, QJsonRpcMethodInvoker*> registeredMethods;
+
+    // method index chosen for a method name and the json types of its
+    // parameters, -1 when no overload matched. Named parameters are also
+    // keyed by name, which fixes where each of them sits in the object
+    struct ResolvedMethod
+    {
+        ResolvedMethod() : index(-1) {}
+
+        int index;
+        QList<int> positions; /* in the named params object, -1 when missing */
+    };
+
+    /*
+     * A cached resolution, filed under a hash of the method name and the json
+     * types (and names) of the params. Looking one up computes that hash and
+     * compares the signature in place, so a hit allocates nothing.
+     */
+    struct ResolvedSignature
+    {
+        ResolvedSignature() : named(false) {}
+
+        QByteArray method;
+        bool named;
+        QVarLengthArray<char, 8> types;
+        QStringList names; /* for named params, in the object's order */
+        ResolvedMethod resolved;
+    };
+    enum { MaxResolvedMethods = 256 };
+    QMutex resolvedMethodsMutex;
+    QHash<uint, ResolvedSignature> resolvedMethods;
+    QAtomicInt resolvedMethodCacheHits;
+    QAtomicInt resolvedMethodCacheMisses;
+
+    QMutex queuedRequestsMutex;
+    QList<QJsonRpcServiceRequest> queuedRequests;
+
+    QThreadPool *threadPool;
+    QMutex invocationsMutex;
+    QWaitCondition invocationsDone;
+    int activeInvocations;
 
     QJsonRpcService * const q_ptr;
     Q_DECLARE_PUBLIC(QJsonRpcService)
 };
 
+/*
+ * The return value and arguments of one metacall. On Qt 5 built-in types are
+ * constructed in place, in an inline buffer that fits most slots, so a call
+ * allocates nothing itself; user types, whose alignment is unknown, get their
+ * own allocation. Qt 4 can't construct in place and keeps them in QVariants
+ * instead.
+ */
+class QJsonRpcArgumentFrame
+{
+public:
+    explicit QJsonRpcArgumentFrame(const QJsonRpcServicePrivate::MethodInfo &info);
+    ~QJsonRpcArgumentFrame();
+
+    static int slotSize(int type);
+
+    // index 0 is the return value, arguments start at 1
+    int type(int index) const;
+    void *value(int index) const { return values[index]; }
+    void setValue(int index, const void *copy);
+    void **data() { return values.data(); }
+
+private:
+    Q_DISABLE_COPY(QJsonRpcArgumentFrame)
+    enum { InlineSize = 128 };
+
+    const QJsonRpcServicePrivate::MethodInfo &info;
+    QVarLengthArray<void *, 10> values;
+#if QT_VERSION >= 0x050000
+    char *storage;
+    union {
+        char inlineStorage[InlineSize];
+        double alignDouble;
+        qint64 alignInt;
+        void *alignPointer;
+    };
+#else
+    QVarLengthArray<QVariant, 10> variants;
+#endif
+};
+
 #endif
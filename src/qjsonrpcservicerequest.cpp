@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QDebug>
+
+#include "qjsonrpcsocket_p.h"
+#include "qjsonrpcsocket.h"
+#include "qjsonrpcservicerequest.h"
+
+class QJsonRpcServiceRequestPrivate : public QSharedData
+{
+public:
+    QJsonRpcServiceRequestPrivate(const QJsonRpcMessage &request, QJsonRpcSocket *socket,
+                                  const QByteArray &method = QByteArray())
+        : request(request),
+          method(method),
+          deadline(-1),
+          responded(0)
+    {
+        // created on the socket's thread, where it's safe to look at it
+        if (socket)
+            this->socket = QJsonRpcSocketPrivate::get(socket)->handle;
+        timer.start();
+    }
+
+    QJsonRpcMessage request;
+    QExplicitlySharedDataPointer<QJsonRpcSocketHandle> socket;
+    QByteArray method;
+    QElapsedTimer timer;    // started on creation, only read after
+    QAtomicInt deadline;    // may be changed by whichever thread holds a copy
+    QAtomicInt responded;
+};
+
+QJsonRpcServiceRequest::QJsonRpcServiceRequest()
+{
+}
+
+QJsonRpcServiceRequest::QJsonRpcServiceRequest(const QJsonRpcMessage &request,
+                                               QJsonRpcSocket *socket)
+    : d(new QJsonRpcServiceRequestPrivate(request, socket))
+{
+}
+
+QJsonRpcServiceRequest::QJsonRpcServiceRequest(const QJsonRpcMessage &request,
+                                               QJsonRpcSocket *socket,
+                                               const QByteArray &method)
+    : d(new QJsonRpcServiceRequestPrivate(request, socket, method))
+{
+}
+
+QJsonRpcServiceRequest::QJsonRpcServiceRequest(const QJsonRpcServiceRequest &other)
+    : d(other.d)
+{
+}
+
+QJsonRpcServiceRequest &QJsonRpcServiceRequest::operator=(const QJsonRpcServiceRequest &other)
+{
+    d = other.d;
+    return *this;
+}
+
+QJsonRpcServiceRequest::~QJsonRpcServiceRequest()
+{
+}
+
+bool QJsonRpcServiceRequest::isValid() const
+{
+    return d && d->request.isValid();
+}
+
+QJsonRpcMessage QJsonRpcServiceRequest::request() const
+{
+    if (!d)
+        return QJsonRpcMessage();
+    return d->request;
+}
+
+QByteArray QJsonRpcServiceRequest::methodName() const
+{
+    if (!d)
+        return QByteArray();
+    return d->method;
+}
+
+QJsonRpcSocket *QJsonRpcServiceRequest::socket() const
+{
+    if (!d || !d->socket)
+        return 0;
+    QMutexLocker locker(&d->socket->mutex);
+    return d->socket->socket;
+}
+
+int QJsonRpcServiceRequest::id() const
+{
+    if (!d)
+        return 0;
+    return d->request.id();
+}
+
+int QJsonRpcServiceRequest::deadline() const
+{
+    if (!d)
+        return -1;
+#if QT_VERSION >= 0x050000
+    return d->deadline.load();
+#else
+    return d->deadline;
+#endif
+}
+
+void QJsonRpcServiceRequest::setDeadline(int msecs)
+{
+    if (d)
+        d->deadline.fetchAndStoreOrdered(qMax(-1, msecs));
+}
+
+bool QJsonRpcServiceRequest::hasExpired() const
+{
+    const int msecs = deadline();
+    if (msecs < 0)
+        return false;
+    return d->timer.hasExpired(msecs);
+}
+
+bool QJsonRpcServiceRequest::hasResponded() const
+{
+    if (!d)
+        return false;
+#if QT_VERSION >= 0x050000
+    return d->responded.load() != 0;
+#else
+    return d->responded != 0;
+#endif
+}
+
+bool QJsonRpcServiceRequest::respond(const QJsonValue &result)
+{
+    if (!d)
+        return false;
+    return respond(d->request.createResponse(result));
+}
+
+bool QJsonRpcServiceRequest::respond(const QJsonRpcMessage &response)
+{
+    if (!d || d->request.type() != QJsonRpcMessage::Request)
+        return false;
+
+    if (!d->responded.testAndSetOrdered(0, 1)) {
+        qDebug() << Q_FUNC_INFO << "request" << d->request.id() << "already answered";
+        return false;
+    }
+
+    // the socket may be going away in its own thread, never touch it from here
+    if (!d->socket)
+        return false;
+    return d->socket->notify(response);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2012-2013 Matt Broadstone
+ * Contact: http://bitbucket.org/devonit/qjsonrpc
+ *
+ * This file is part of the QJsonRpc Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+#ifndef QJSONRPCSERVICEREQUEST_H
+#define QJSONRPCSERVICEREQUEST_H
+
+#include <QExplicitlySharedDataPointer>
+
+#include "qjsonrpc_export.h"
+#include "qjsonrpcmessage.h"
+
+class QJsonRpcSocket;
+class QJsonRpcServiceRequestPrivate;
+class QJSONRPC_EXPORT QJsonRpcServiceRequest
+{
+public:
+    QJsonRpcServiceRequest();
+    QJsonRpcServiceRequest(const QJsonRpcMessage &request, QJsonRpcSocket *socket);
+    QJsonRpcServiceRequest(const QJsonRpcServiceRequest &other);
+    QJsonRpcServiceRequest &operator=(const QJsonRpcServiceRequest &other);
+    ~QJsonRpcServiceRequest();
+
+    bool isValid() const;
+    QJsonRpcMessage request() const;
+    // 0 once the socket is gone; only dereference it in the socket's own thread
+    QJsonRpcSocket *socket() const;
+    int id() const;
+
+    // msecs after receipt the answer is still of use to the caller, -1 for no
+    // limit; providers set their requestTimeout(). A request that expired
+    // before its slot runs is answered with QJsonRpc::TimeoutError, slots and
+    // delayed responders check hasExpired() to skip work that would come too late
+    int deadline() const;
+    void setDeadline(int msecs);
+    bool hasExpired() const;
+
+    // sends response from any thread, once; copies share that state. Off the
+    // socket's thread the response is queued to it and dropped if it goes away
+    bool respond(const QJsonRpcMessage &response);
+    bool respond(const QJsonValue &result);
+    bool hasResponded() const;
+
+private:
+    // method is the name within the service, known to the provider's routes
+    QJsonRpcServiceRequest(const QJsonRpcMessage &request, QJsonRpcSocket *socket,
+                           const QByteArray &method);
+    QByteArray methodName() const;
+
+    QExplicitlySharedDataPointer<QJsonRpcServiceRequestPrivate> d;
+    friend class QJsonRpcServiceProvider;
+    friend class QJsonRpcServicePrivate;
+
+};
+
+#endif
@@ -1,80 +1,510 @@
+#include <string.h>
+#include <ctype.h>
+
 #include <QTimer>
 #include <QEventLoop>
+#include <QMutexLocker>
+#include <QThread>
+#include <QAbstractSocket>
+#include <QLocalSocket>
+#include <QtEndian>
 #include <QDebug>
 
 #include "qjsonrpcservice.h"
 #include "qjsonrpcservicereply_p.h"
 #include "qjsonrpcservicereply.h"
+#include "qjsonrpcmessage_p.h"
 #include "qjsonrpcsocket_p.h"
 #include "qjsonrpcsocket.h"
 
-int QJsonRpcSocketPrivate::findJsonDocumentEnd(const QByteArray &jsonData)
+/*
+ * Structural character scanning: the framer only cares about '{', '}', '[',
+ * ']', '"' and '\\'. On x86 the input is classified 32 bytes at a time into
+ * a bitmask of those characters (as in simdjson's stage 1), and only the set
+ * bits are walked by the framing state machine. Everything else falls back to
+ * the byte at a time loop.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QJSONRPC_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(QJSONRPC_HAVE_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QJSONRPC_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+typedef uint (*StructuralMaskFunction)(const char *data);
+
+#ifdef QJSONRPC_HAVE_SSE2
+static inline uint structuralMask16(__m128i chunk)
+{
+    // '[' and ']' only differ from '{' and '}' by 0x20
+    const __m128i folded = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+    __m128i mask = _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                                _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+    return _mm_movemask_epi8(mask);
+}
+
+static uint structuralMaskSse2(const char *data)
+{
+    const uint low = structuralMask16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data)));
+    const uint high = structuralMask16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16)));
+    return low | (high << 16);
+}
+#endif
+
+#ifdef QJSONRPC_HAVE_AVX2
+__attribute__((target("avx2")))
+static uint structuralMaskAvx2(const char *data)
+{
+    const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    const __m256i folded = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+    __m256i mask = _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                                   _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"')));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\\')));
+    return static_cast<uint>(_mm256_movemask_epi8(mask));
+}
+#endif
+
+static inline int countTrailingZeros(uint mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int count = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+static QJsonRpcSocketPrivate::ScannerImplementation bestScannerImplementation()
+{
+#ifdef QJSONRPC_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return QJsonRpcSocketPrivate::Avx2Scanner;
+#endif
+#ifdef QJSONRPC_HAVE_SSE2
+    return QJsonRpcSocketPrivate::Sse2Scanner;
+#else
+    return QJsonRpcSocketPrivate::ScalarScanner;
+#endif
+}
+
+static StructuralMaskFunction structuralMaskFunction(QJsonRpcSocketPrivate::ScannerImplementation implementation)
 {
-    const char* pos = jsonData.constData();
-    const char* end = pos + jsonData.length();
+    switch (implementation) {
+#ifdef QJSONRPC_HAVE_AVX2
+    case QJsonRpcSocketPrivate::Avx2Scanner:
+        return structuralMaskAvx2;
+#endif
+#ifdef QJSONRPC_HAVE_SSE2
+    case QJsonRpcSocketPrivate::Sse2Scanner:
+        return structuralMaskSse2;
+#endif
+    default:
+        return 0;
+    }
+}
 
-    char blockStart = 0;
-    char blockEnd = 0;
-    int index = 0;
+// read by every socket, in whichever thread it lives; -1 until first used
+static QAtomicInt currentScannerImplementation(-1);
+
+QJsonRpcSocketPrivate::ScannerImplementation QJsonRpcSocketPrivate::scannerImplementation()
+{
+#if QT_VERSION >= 0x050000
+    int implementation = currentScannerImplementation.load();
+#else
+    int implementation = currentScannerImplementation;
+#endif
+    if (implementation == -1) {
+        // racing first users all pick the same one
+        currentScannerImplementation.testAndSetOrdered(-1, bestScannerImplementation());
+#if QT_VERSION >= 0x050000
+        implementation = currentScannerImplementation.load();
+#else
+        implementation = currentScannerImplementation;
+#endif
+    }
+
+    return static_cast<ScannerImplementation>(implementation);
+}
+
+bool QJsonRpcSocketPrivate::setScannerImplementation(ScannerImplementation implementation)
+{
+    if (implementation > bestScannerImplementation())
+        return false;
+
+    currentScannerImplementation.fetchAndStoreOrdered(implementation);
+    return true;
+}
+
+int QJsonRpcSocketPrivate::findJsonDocumentEnd(const QByteArray &jsonData, int from)
+{
+    const char *data = jsonData.constData();
+    const int length = jsonData.length();
+    int index = qMax(from, scanPosition);
 
     // Find the beginning of the JSON document and determine if it is an object or an array
-    while (true) {
-        if (pos == end) {
-            return -1;
-        } else if (*pos == '{') {
-            blockStart = '{';
-            blockEnd = '}';
-            break;
-        } else if(*pos == '[') {
-            blockStart = '[';
-            blockEnd = ']';
-            break;
+    if (scanDepth == 0) {
+        while (true) {
+            if (index >= length) {
+                scanPosition = index;
+                return -1;
+            } else if (data[index] == '{') {
+                documentStart = index;
+                blockStart = '{';
+                blockEnd = '}';
+                break;
+            } else if (data[index] == '[') {
+                documentStart = index;
+                blockStart = '[';
+                blockEnd = ']';
+                break;
+            }
+
+            index++;
         }
 
-        pos++;
         index++;
+        scanDepth = 1;
+        escapedPosition = -1;
     }
 
-    // Find the end of the JSON document
-    pos++;
-    index++;
-    int depth = 1;
-    bool inString = false;
-    while (depth > 0 && pos != end) {
-        if (*pos == '\\') {
-            pos += 2;
-            index += 2;
-            continue;
-        } else if (*pos == '"') {
-            inString = !inString;
-        } else if (!inString) {
-            if (*pos == blockStart)
-                depth++;
-            else if (*pos == blockEnd)
-                depth--;
+    // Find the end of the JSON document, picking up where the last call stopped
+    const StructuralMaskFunction mask = structuralMaskFunction(scannerImplementation());
+    while (index < length) {
+        int position = index;
+        uint bits = 1;
+        if (mask && length - index >= 32) {
+            bits = mask(data + index);
+            index += 32;
+        } else {
+            index++;
         }
 
-        pos++;
-        index++;
+        for (; bits; bits &= bits - 1) {
+            const int current = position + countTrailingZeros(bits);
+            const char c = data[current];
+            if (current == escapedPosition) {
+                // escaped character, skip it
+            } else if (c == '\\') {
+                escapedPosition = current + 1;
+            } else if (c == '"') {
+                scanInString = !scanInString;
+            } else if (!scanInString) {
+                if (c == blockStart) {
+                    scanDepth++;
+                } else if (c == blockEnd && --scanDepth == 0) {
+                    resetFramingState();
+                    return current;
+                }
+            }
+        }
     }
 
-    // index-1 because we are one position ahead
-    return depth == 0 ? index-1 : -1;
+    scanPosition = index;
+    return -1;
+}
+
+void QJsonRpcSocketPrivate::resetFramingState()
+{
+    scanPosition = 0;
+    scanDepth = 0;
+    scanInString = false;
+    escapedPosition = -1;
+    blockStart = 0;
+    blockEnd = 0;
 }
 
 void QJsonRpcSocketPrivate::writeData(const QJsonRpcMessage &message)
 {
-    QJsonDocument doc = QJsonDocument(message.toObject());
+    // answers to a batch are sent together once all of them are in, anything
+    // else written meanwhile (notifications, requests) goes out as usual
+    if ((message.type() == QJsonRpcMessage::Response ||
+         message.type() == QJsonRpcMessage::Error) && collectBatchResponse(message))
+        return;
+
+    // already encoded for a broadcast, write the shared bytes as they are
+    const int key = encodingKey();
+    const QByteArray payload = QJsonRpcMessagePrivate::encodedPayload(message, key);
+    if (!payload.isEmpty()) {
+        writePayload(payload);
+        return;
+    }
+
+    // compact text is written straight from the message, without building
+    // a document first; indented and binary encodings still need one
+    if (writesCompactText()) {
+        serializeBuffer.resize(0);
+        message.serialize(serializeBuffer);
+        writePayload(serializeBuffer);
+        return;
+    }
+
+    writeDocument(QJsonDocument(message.toObject()));
+}
+
+void QJsonRpcSocketPrivate::writeDocument(const QJsonDocument &doc)
+{
+    writePayload(encode(doc));
+}
+
+void QJsonRpcSocketPrivate::writePayload(const QByteArray &payload)
+{
+    writeFrame(payload);
+    if (qgetenv("QJSONRPC_DEBUG").toInt())
+        qDebug() << "sending: " << payload;
+}
+
+int QJsonRpcSocketPrivate::encodingKey() const
+{
+    // binary documents may contain any byte, including '\n'
+    if (writesBinary() && framing != QJsonRpc::NewlineFraming)
+        return -1;
 
 #if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
-    QByteArray data = doc.toJson(format);
+    // a newline delimited message must not contain a raw newline itself
+    return framing == QJsonRpc::NewlineFraming ? int(QJsonDocument::Compact) : int(format);
+#else
+    return framing == QJsonRpc::NewlineFraming ? 1 : 0;
+#endif
+}
+
+bool QJsonRpcSocketPrivate::writesBinary() const
+{
+    return encoding == QJsonRpc::BinaryEncoding ||
+           (encoding == QJsonRpc::MatchPeerEncoding && peerSentBinary);
+}
+
+QJsonRpc::Encoding QJsonRpcSocketPrivate::supportedEncoding(QJsonRpc::Encoding encoding)
+{
+#ifndef QJSONRPC_HAVE_BINARY_JSON
+    if (encoding == QJsonRpc::BinaryEncoding) {
+        qWarning() << "binary encoding is not available with this Qt version, using text";
+        return QJsonRpc::TextEncoding;
+    }
+#endif
+    return encoding;
+}
+
+bool QJsonRpcSocketPrivate::writesCompactText() const
+{
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+    return encodingKey() == int(QJsonDocument::Compact);
+#else
+    return encodingKey() == 1;
+#endif
+}
+
+QByteArray QJsonRpcSocketPrivate::encode(const QJsonDocument &doc) const
+{
+    return encode(doc, encodingKey());
+}
+
+QByteArray QJsonRpcSocketPrivate::encode(const QJsonDocument &doc, int key)
+{
+#ifdef QJSONRPC_HAVE_BINARY_JSON
+    if (key == -1)
+        return doc.toBinaryData();
+#endif
+
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+    return doc.toJson(static_cast<QJsonDocument::JsonFormat>(key));
 #else
     QByteArray data = doc.toJson();
+    if (key == 1)
+        data.replace('\n', "");   // newlines only ever appear between tokens
+    return data;
 #endif
+}
 
-    device.data()->write(data);
-    if (qgetenv("QJSONRPC_DEBUG").toInt())
-        qDebug() << "sending: " << data;
+void QJsonRpcSocketPrivate::publishState()
+{
+#if QT_VERSION >= 0x050000
+    sharedKey.storeRelease(encodingKey());
+    sharedCongested.storeRelease(congested ? 1 : 0);
+#else
+    sharedKey = encodingKey();
+    sharedCongested = congested ? 1 : 0;
+#endif
+}
+
+int QJsonRpcSocketPrivate::sharedEncodingKey() const
+{
+#if QT_VERSION >= 0x050000
+    return sharedKey.loadAcquire();
+#else
+    return sharedKey;
+#endif
+}
+
+bool QJsonRpcSocketPrivate::isSharedCongested() const
+{
+#if QT_VERSION >= 0x050000
+    return sharedCongested.loadAcquire() != 0;
+#else
+    return sharedCongested != 0;
+#endif
+}
+
+void QJsonRpcSocketPrivate::writeFrame(const QByteArray &payload)
+{
+    switch (framing) {
+    case QJsonRpc::ContentLengthFraming:
+        writeRaw("Content-Length: " + QByteArray::number(payload.size()) + "\r\n\r\n");
+        writeRaw(payload);
+        break;
+
+    case QJsonRpc::LengthPrefixFraming: {
+        uchar header[4];
+        qToBigEndian<quint32>(payload.size(), header);
+        outgoing.append(reinterpret_cast<const char *>(header), sizeof(header));
+        writeRaw(payload);
+        break;
+    }
+
+    case QJsonRpc::NewlineFraming:
+        writeRaw(payload);
+        outgoing.append('\n');
+        break;
+
+    default:
+        writeRaw(payload);
+        break;
+    }
+
+    /*
+     * Without coalescing every frame is written right away, in a single
+     * write. Otherwise frames pile up until the threshold is reached or
+     * control returns to the event loop.
+     */
+    if (!coalesceWrites || outgoing.size() >= coalescingThreshold) {
+        _q_flushOutgoingData();
+    } else if (!flushScheduled) {
+        Q_Q(QJsonRpcSocket);
+        flushScheduled = true;
+        QMetaObject::invokeMethod(q, "_q_flushOutgoingData", Qt::QueuedConnection);
+    }
+
+    _q_updateBackpressure();
+}
+
+void QJsonRpcSocketPrivate::writeRaw(const QByteArray &data)
+{
+    if (outgoing.isEmpty())
+        outgoing = data;    // shared, no copy
+    else
+        outgoing.append(data);
+}
+
+void QJsonRpcSocketPrivate::_q_flushOutgoingData()
+{
+    flushScheduled = false;
+    if (outgoing.isEmpty())
+        return;
+
+    if (!device) {
+        qDebug() << Q_FUNC_INFO << "trying to flush data without device";
+        outgoing.clear();
+        return;
+    }
+
+    device.data()->write(outgoing);
+    flushCount++;
+    flushedBytes += outgoing.size();
+    outgoing.clear();
+}
+
+qint64 QJsonRpcSocketPrivate::pendingBytes() const
+{
+    qint64 pending = outgoing.size();
+    if (device)
+        pending += device.data()->bytesToWrite();
+    return pending;
+}
+
+void QJsonRpcSocketPrivate::_q_updateBackpressure()
+{
+    Q_Q(QJsonRpcSocket);
+    if (!congested) {
+        if (highWaterMark > 0 && pendingBytes() >= highWaterMark) {
+            congested = true;
+            publishState();
+            pauseReading();
+            Q_EMIT q->highWaterMarkReached();
+        }
+    } else if (highWaterMark <= 0 || pendingBytes() <= lowWaterMark) {
+        congested = false;
+        publishState();
+        resumeReading();
+        Q_EMIT q->lowWaterMarkReached();
+    }
+}
+
+void QJsonRpcSocketPrivate::_q_abortDevice()
+{
+    // abort rather than close, closing would wait for the backlog to drain
+    if (QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device.data()))
+        socket->abort();
+    else if (QLocalSocket *socket = qobject_cast<QLocalSocket*>(device.data()))
+        socket->abort();
+    else if (device)
+        device.data()->close();
+}
+
+/*
+ * While congested no more requests are read or dispatched. For sockets the
+ * read buffer is shrunk as well, so unread data stays in the kernel and the
+ * peer is slowed down by flow control instead of growing our buffers.
+ */
+void QJsonRpcSocketPrivate::pauseReading()
+{
+    if (QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device.data())) {
+        savedReadBufferSize = socket->readBufferSize();
+        socket->setReadBufferSize(1);
+    } else if (QLocalSocket *socket = qobject_cast<QLocalSocket*>(device.data())) {
+        savedReadBufferSize = socket->readBufferSize();
+        socket->setReadBufferSize(1);
+    }
+}
+
+void QJsonRpcSocketPrivate::resumeReading()
+{
+    Q_Q(QJsonRpcSocket);
+    if (QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device.data()))
+        socket->setReadBufferSize(savedReadBufferSize);
+    else if (QLocalSocket *socket = qobject_cast<QLocalSocket*>(device.data()))
+        socket->setReadBufferSize(savedReadBufferSize);
+
+    // whatever was left or arrived meanwhile will not be announced again
+    if (readOffset < buffer.size() || (device && device.data()->bytesAvailable() > 0))
+        QMetaObject::invokeMethod(q, "_q_processIncomingData", Qt::QueuedConnection);
+}
+
+bool QJsonRpcSocketHandle::notify(const QJsonRpcMessage &message)
+{
+    QMutexLocker locker(&mutex);
+    if (!socket)
+        return false;
+
+    if (socket->thread() == QThread::currentThread()) {
+        // can't go away under its own thread, and notify() may answer more requests
+        QJsonRpcSocket *target = socket;
+        locker.unlock();
+        target->notify(message);
+    } else {
+        QMetaObject::invokeMethod(socket, "notify", Qt::QueuedConnection,
+                                  Q_ARG(QJsonRpcMessage, message));
+    }
+    return true;
 }
 
 QJsonRpcSocket::QJsonRpcSocket(QIODevice *device, QObject *parent)
@@ -82,7 +512,9 @@ QJsonRpcSocket::QJsonRpcSocket(QIODevice *device, QObject *parent)
 {
     Q_D(QJsonRpcSocket);
     connect(device, SIGNAL(readyRead()), this, SLOT(_q_processIncomingData()));
+    connect(device, SIGNAL(bytesWritten(qint64)), this, SLOT(_q_updateBackpressure()));
     d->device = device;
+    d->handle = new QJsonRpcSocketHandle(this);
 }
 
 QJsonRpcSocket::QJsonRpcSocket(QJsonRpcSocketPrivate &dd, QObject *parent)
@@ -90,10 +522,18 @@ QJsonRpcSocket::QJsonRpcSocket(QJsonRpcSocketPrivate &dd, QObject *parent)
 {
     Q_D(QJsonRpcSocket);
     connect(d->device, SIGNAL(readyRead()), this, SLOT(_q_processIncomingData()));
+    connect(d->device, SIGNAL(bytesWritten(qint64)), this, SLOT(_q_updateBackpressure()));
+    d->handle = new QJsonRpcSocketHandle(this);
 }
 
 QJsonRpcSocket::~QJsonRpcSocket()
 {
+    Q_D(QJsonRpcSocket);
+    QMutexLocker locker(&d->handle->mutex);
+    d->handle->socket = 0;
+    locker.unlock();
+
+    d->_q_flushOutgoingData();
 }
 
 bool QJsonRpcSocket::isValid() const
@@ -102,19 +542,6 @@ bool QJsonRpcSocket::isValid() const
     return d->device && d->device.data()->isOpen();
 }
 
-/*
-void QJsonRpcSocket::sendMessage(const QList<QJsonRpcMessage> &messages)
-{
-    QJsonArray array;
-    foreach (QJsonRpcMessage message, messages) {
-        array.append(message.toObject());
-    }
-
-    QJsonDocument doc = QJsonDocument(array);
-    m_device.data()->write(doc.toBinaryData());
-}
-*/
-
 QJsonRpcMessage QJsonRpcSocket::sendMessageBlocking(const QJsonRpcMessage &message, int msecs)
 {
     Q_D(QJsonRpcSocket);
@@ -148,6 +575,46 @@ QJsonRpcServiceReply *QJsonRpcSocket::sendMessage(const QJsonRpcMessage &message
     return reply;
 }
 
+QList<QJsonRpcServiceReply*> QJsonRpcSocket::sendMessages(const QList<QJsonRpcMessage> &messages)
+{
+    Q_D(QJsonRpcSocket);
+    QList<QJsonRpcServiceReply*> result;
+    if (!d->device) {
+        qDebug() << Q_FUNC_INFO << "trying to send messages without device";
+        return result;
+    }
+
+    if (messages.isEmpty())
+        return result;
+
+    int duplicateId;
+    if (!QJsonRpcMessagePrivate::hasUniqueRequestIds(messages, &duplicateId)) {
+        qDebug() << Q_FUNC_INFO << "duplicate request id" << duplicateId << "in batch";
+        return result;
+    }
+
+    // one batch, one write; notifications in it get no reply
+    foreach (const QJsonRpcMessage &message, messages) {
+        if (message.type() == QJsonRpcMessage::Request) {
+            QPointer<QJsonRpcServiceReply> reply(new QJsonRpcServiceReply);
+            d->replies.insert(message.id(), reply);
+            result.append(reply);
+        }
+    }
+
+    if (d->writesCompactText()) {
+        d->serializeBuffer.resize(0);
+        QJsonRpcMessagePrivate::serializeBatch(messages, d->serializeBuffer);
+        d->writePayload(d->serializeBuffer);
+    } else {
+        QJsonArray batch;
+        foreach (const QJsonRpcMessage &message, messages)
+            batch.append(message.toObject());
+        d->writeDocument(QJsonDocument(batch));
+    }
+    return result;
+}
+
 void QJsonRpcSocket::notify(const QJsonRpcMessage &message)
 {
     Q_D(QJsonRpcSocket);
@@ -156,11 +623,6 @@ void QJsonRpcSocket::notify(const QJsonRpcMessage &message)
         return;
     }
 
-    // disconnect the result message if we need to
-    QJsonRpcService *service = qobject_cast<QJsonRpcService*>(sender());
-    if (service)
-        disconnect(service, SIGNAL(result(QJsonRpcMessage)), this, SLOT(notify(QJsonRpcMessage)));
-
     d->writeData(message);
 }
 
@@ -212,6 +674,121 @@ QJsonRpcServiceReply *QJsonRpcSocket::invokeRemoteMethod(const QString &method,
     return sendMessage(request);
 }
 
+QJsonRpc::Framing QJsonRpcSocket::framing() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->framing;
+}
+
+void QJsonRpcSocket::setFraming(QJsonRpc::Framing framing)
+{
+    Q_D(QJsonRpcSocket);
+    d->framing = framing;
+    d->publishState();
+}
+
+bool QJsonRpcSocket::isWriteCoalescingEnabled() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->coalesceWrites;
+}
+
+void QJsonRpcSocket::setWriteCoalescingEnabled(bool enabled)
+{
+    Q_D(QJsonRpcSocket);
+    d->coalesceWrites = enabled;
+    if (!enabled)
+        d->_q_flushOutgoingData();
+}
+
+int QJsonRpcSocket::writeCoalescingThreshold() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->coalescingThreshold;
+}
+
+void QJsonRpcSocket::setWriteCoalescingThreshold(int bytes)
+{
+    Q_D(QJsonRpcSocket);
+    d->coalescingThreshold = bytes;
+}
+
+qint64 QJsonRpcSocket::flushCount() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->flushCount;
+}
+
+qint64 QJsonRpcSocket::flushedBytes() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->flushedBytes;
+}
+
+void QJsonRpcSocket::flush()
+{
+    Q_D(QJsonRpcSocket);
+    d->_q_flushOutgoingData();
+}
+
+qint64 QJsonRpcSocket::highWaterMark() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->highWaterMark;
+}
+
+void QJsonRpcSocket::setHighWaterMark(qint64 bytes)
+{
+    Q_D(QJsonRpcSocket);
+    d->highWaterMark = bytes;
+    d->_q_updateBackpressure();
+}
+
+qint64 QJsonRpcSocket::lowWaterMark() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->lowWaterMark;
+}
+
+void QJsonRpcSocket::setLowWaterMark(qint64 bytes)
+{
+    Q_D(QJsonRpcSocket);
+    d->lowWaterMark = bytes;
+    d->_q_updateBackpressure();
+}
+
+bool QJsonRpcSocket::isCongested() const
+{
+    // safe to ask from other threads
+    Q_D(const QJsonRpcSocket);
+    return d->isSharedCongested();
+}
+
+QJsonRpc::Encoding QJsonRpcSocket::encoding() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->encoding;
+}
+
+void QJsonRpcSocket::setEncoding(QJsonRpc::Encoding encoding)
+{
+    Q_D(QJsonRpcSocket);
+    d->encoding = QJsonRpcSocketPrivate::supportedEncoding(encoding);
+    d->publishState();
+}
+
+bool QJsonRpcSocket::isLazyParsingEnabled() const
+{
+    Q_D(const QJsonRpcSocket);
+    return d->lazyParsing;
+}
+
+void QJsonRpcSocket::setLazyParsingEnabled(bool enabled)
+{
+    Q_D(QJsonRpcSocket);
+    d->lazyParsing = enabled;
+}
+
 #if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
 QJsonDocument::JsonFormat QJsonRpcSocket::wireFormat() const
 {
@@ -223,62 +800,354 @@ void QJsonRpcSocket::setWireFormat(QJsonDocument::JsonFormat format)
 {
     Q_D(QJsonRpcSocket);
     d->format = format;
+    d->publishState();
 }
 #endif
 
 void QJsonRpcSocketPrivate::_q_processIncomingData()
 {
-    Q_Q(QJsonRpcSocket);
     if (!device) {
         qDebug() << Q_FUNC_INFO << "called without device";
         return;
     }
 
-    buffer.append(device.data()->readAll());
-    while (!buffer.isEmpty()) {
-        int dataSize = findJsonDocumentEnd(buffer);
-        if (dataSize == -1) {
-            // incomplete data, wait for more
-            return;
-        }
+    // picked up again once the peer has drained our output
+    if (congested)
+        return;
 
-        QJsonDocument document = QJsonDocument::fromJson(buffer);
-        if (document.isEmpty())
-            break;
-
-        buffer = buffer.mid(dataSize + 1);
-        if (document.isArray()) {
-            qDebug() << Q_FUNC_INFO << "bulk support is current disabled";
-            /*
-            for (int i = 0; i < document.array().size(); ++i) {
-                QJsonObject messageObject = document.array().at(i).toObject();
-                if (!messageObject.isEmpty()) {
-                    QJsonRpcMessage message(messageObject);
-                    Q_EMIT messageReceived(message);
+    if (readOffset == buffer.size()) {
+        // everything was consumed, take over the device data without copying
+        buffer = device.data()->readAll();
+        readOffset = 0;
+    } else {
+        buffer.append(device.data()->readAll());
+    }
+
+    int payloadStart;
+    int payloadSize;
+    while (!congested && readOffset < buffer.size() && nextFrame(&payloadStart, &payloadSize)) {
+        QJsonDocument document;
+        const char *payload = buffer.constData() + payloadStart;
+        if (isBinaryDocument(payload, payloadSize)) {
+#ifdef QJSONRPC_HAVE_BINARY_JSON
+            // no text parsing needed, but buffer is reused, so the document
+            // gets its own (suitably aligned) copy rather than using fromRawData
+            document = QJsonDocument::fromBinaryData(QByteArray(payload, payloadSize));
+
+            // the peer understands binary messages, answered in kind if asked to
+            if (!document.isNull() && !peerSentBinary) {
+                peerSentBinary = true;
+                if (encoding == QJsonRpc::MatchPeerEncoding)
+                    publishState();
+            }
+#else
+            // still framed by its size, so the stream stays in step
+            qWarning() << Q_FUNC_INFO << "binary documents are not supported with this Qt version";
+#endif
+        } else {
+            // requests keep their own copy of the text, params are parsed from it on use
+            if (lazyParsing && payload[0] == '{') {
+                const QByteArray json(payload, payloadSize);
+                QJsonRpcMessage message;
+                if (QJsonRpcMessagePrivate::parseEnvelope(json, &message)) {
+                    if (qgetenv("QJSONRPC_DEBUG").toInt())
+                        qDebug() << "received: " << json;
+                    processMessage(message);
+                    continue;
                 }
             }
-            */
-        } else if (document.isObject()){
-            if (qgetenv("QJSONRPC_DEBUG").toInt())
-                qDebug() << "received: " << document.toJson();
-
-            QJsonRpcMessage message(document.object());
-            Q_EMIT q->messageReceived(message);
-
-            if (message.type() == QJsonRpcMessage::Response ||
-                message.type() == QJsonRpcMessage::Error) {
-                if (replies.contains(message.id())) {
-                    QPointer<QJsonRpcServiceReply> reply = replies.take(message.id());
-                    if (!reply.isNull()) {
-                        reply->d_func()->response = message;
-                        reply->finished();
-                    }
+
+            // parse exactly the framed document, in place
+            document = QJsonDocument::fromJson(QByteArray::fromRawData(payload, payloadSize));
+        }
+        if (document.isNull()) {
+            qDebug() << Q_FUNC_INFO << "unable to parse incoming document, skipping it";
+            continue;
+        }
+
+        if (qgetenv("QJSONRPC_DEBUG").toInt())
+            qDebug() << "received: " << document.toJson();
+
+        if (document.isArray())
+            processBatch(document.array());
+        else if (document.isObject())
+            processMessage(QJsonRpcMessage(document.object()));
+    }
+
+    compactBuffer();
+}
+
+void QJsonRpcSocketPrivate::processMessage(const QJsonRpcMessage &message)
+{
+    Q_Q(QJsonRpcSocket);
+    Q_EMIT q->messageReceived(message);
+
+    if (message.type() == QJsonRpcMessage::Response ||
+        message.type() == QJsonRpcMessage::Error) {
+        if (replies.contains(message.id())) {
+            QPointer<QJsonRpcServiceReply> reply = replies.take(message.id());
+            if (!reply.isNull()) {
+                reply->d_func()->response = message;
+                reply->finished();
+            }
+        }
+    } else {
+        q->processRequestMessage(message);
+    }
+}
+
+void QJsonRpcSocketPrivate::processBatch(const QJsonArray &batch)
+{
+    // an empty batch is answered with a single invalid request error
+    if (batch.isEmpty()) {
+        processMessage(QJsonRpcMessage(QJsonObject()));
+        return;
+    }
+
+    /*
+     * Every element is handled like a message on its own; the answers to it
+     * (responses, errors for invalid elements) are collected and written as
+     * one array once the last is in, whether it is given right away or
+     * later by a pooled, delayed or queued service. Notifications produce
+     * nothing, a batch made only of them is never answered.
+     */
+    PendingBatch pending;
+    QList<QJsonRpcMessage> messages;
+    for (int i = 0; i < batch.size(); ++i) {
+        const QJsonRpcMessage message(batch.at(i).toObject());
+        messages.append(message);
+
+        // requests are answered, invalid elements get an error with their id
+        if (message.type() != QJsonRpcMessage::Notification &&
+            message.type() != QJsonRpcMessage::Response &&
+            message.type() != QJsonRpcMessage::Error)
+            pending.ids[message.id()]++;
+    }
+
+    if (!pending.ids.isEmpty())
+        pendingBatches.append(pending);
+    for (int i = 0; i < messages.size(); ++i)
+        processMessage(messages.at(i));
+}
+
+bool QJsonRpcSocketPrivate::collectBatchResponse(const QJsonRpcMessage &message)
+{
+    // the oldest batch still waiting for the id gets the answer
+    for (int i = 0; i < pendingBatches.size(); ++i) {
+        PendingBatch &pending = pendingBatches[i];
+        QHash<int, int>::iterator it = pending.ids.find(message.id());
+        if (it == pending.ids.end())
+            continue;
+
+        if (--it.value() == 0)
+            pending.ids.erase(it);
+        pending.responses.append(message.toObject());
+        if (pending.ids.isEmpty()) {
+            const QJsonArray responses = pending.responses;
+            pendingBatches.removeAt(i);
+            writeDocument(QJsonDocument(responses));
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool QJsonRpcSocketPrivate::nextFrame(int *payloadStart, int *payloadSize)
+{
+    if (framing == QJsonRpc::StreamFraming) {
+        // binary documents carry their own size, whitespace left after a
+        // text document must not hide their tag
+        if (scanDepth == 0) {
+            while (readOffset < buffer.size() && isspace(uchar(buffer.at(readOffset))))
+                readOffset++;
+
+            const int binarySize = binaryDocumentSize(readOffset);
+            if (binarySize == 0 || (binarySize > 0 && buffer.size() - readOffset < binarySize))
+                return false;
+
+            if (binarySize > 0) {
+                *payloadStart = readOffset;
+                *payloadSize = binarySize;
+                readOffset += binarySize;
+                return true;
+            }
+        }
+
+        int dataEnd = findJsonDocumentEnd(buffer, readOffset);
+        if (dataEnd == -1) {
+            // incomplete data, wait for more, anything before a document start is dropped
+            if (scanDepth == 0)
+                readOffset = buffer.size();
+            return false;
+        }
+
+        *payloadStart = documentStart;
+        *payloadSize = dataEnd - documentStart + 1;
+        readOffset = dataEnd + 1;
+        return true;
+    }
+
+    if (framing == QJsonRpc::NewlineFraming) {
+        // compact documents never contain a raw newline, the next one ends the message
+        for (;;) {
+            const int from = qMax(readOffset, scanPosition);
+            const char *newline = static_cast<const char *>(
+                memchr(buffer.constData() + from, '\n', buffer.size() - from));
+            if (!newline) {
+                scanPosition = buffer.size();
+                return false;
+            }
+
+            const int lineEnd = newline - buffer.constData();
+            *payloadStart = readOffset;
+            *payloadSize = lineEnd - readOffset;
+            readOffset = scanPosition = lineEnd + 1;
+
+            // skip blank lines
+            if (*payloadSize > 1 || (*payloadSize == 1 && buffer.at(*payloadStart) != '\r'))
+                return true;
+        }
+    }
+
+    // the size is known up front, no scanning needed
+    if (frameSize == -1 && !readFrameHeader())
+        return false;
+
+    if (buffer.size() - framePayloadStart < frameSize)
+        return false;
+
+    *payloadStart = framePayloadStart;
+    *payloadSize = frameSize;
+    readOffset = framePayloadStart + frameSize;
+    frameSize = -1;
+    return true;
+}
+
+bool QJsonRpcSocketPrivate::readFrameHeader()
+{
+    // the announced size comes from the peer, don't let it size allocations
+    static const int maximumPreallocatedSize = 64 * 1024;
+
+    if (framing == QJsonRpc::LengthPrefixFraming) {
+        if (buffer.size() - readOffset < 4)
+            return false;
+
+        const quint32 size =
+            qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(buffer.constData() + readOffset));
+        if (size > quint32(0x7fffffff - 4 - readOffset)) {
+            qWarning() << Q_FUNC_INFO << "invalid frame size" << size << ", dropping buffered data";
+            readOffset = buffer.size();
+            return false;
+        }
+
+        framePayloadStart = readOffset + 4;
+        frameSize = size;
+    } else {
+        // a peer never ending its header must not grow the buffer forever
+        static const int maximumHeaderSize = 8 * 1024;
+
+        int headerEnd;
+        int size = -1;
+        while (size < 0) {
+            headerEnd = buffer.indexOf("\r\n\r\n", readOffset);
+            if (headerEnd == -1 ? buffer.size() - readOffset > maximumHeaderSize
+                                : headerEnd - readOffset > maximumHeaderSize) {
+                Q_Q(QJsonRpcSocket);
+                qWarning() << Q_FUNC_INFO << "frame header too large, closing the connection";
+                readOffset = buffer.size();
+                QMetaObject::invokeMethod(q, "_q_abortDevice", Qt::QueuedConnection);
+                return false;
+            }
+            if (headerEnd == -1)
+                return false;
+
+            const QList<QByteArray> lines =
+                buffer.mid(readOffset, headerEnd - readOffset).split('\n');
+            foreach (const QByteArray &line, lines) {
+                const int separator = line.indexOf(':');
+                if (line.left(separator).trimmed().toLower() == "content-length") {
+                    bool ok;
+                    size = line.mid(separator + 1).trimmed().toInt(&ok);
+                    if (!ok)
+                        size = -1;
+                    break;
                 }
-            } else {
-                q->processRequestMessage(message);
+            }
+
+            if (size < 0) {
+                qWarning() << Q_FUNC_INFO << "frame header without a valid Content-Length, skipping it";
+                readOffset = headerEnd + 4;
             }
         }
+
+        framePayloadStart = headerEnd + 4;
+        frameSize = size;
+    }
+
+    // small frames get room at once, larger ones grow as their data arrives
+    if (frameSize <= maximumPreallocatedSize)
+        buffer.reserve(framePayloadStart + frameSize);
+    return true;
+}
+
+/*
+ * The binary representation starts with the "qbjs" tag and a version,
+ * followed by the root object whose first field is its total size, all
+ * little endian.
+ */
+static const char binaryTag[] = { 'q', 'b', 'j', 's' };
+static const int binaryHeaderSize = 8;
+
+int QJsonRpcSocketPrivate::binaryDocumentSize(int from) const
+{
+    const int available = buffer.size() - from;
+    if (memcmp(buffer.constData() + from, binaryTag, qMin<int>(available, sizeof(binaryTag))) != 0)
+        return -1;
+
+    if (available < binaryHeaderSize + 4)
+        return 0;
+
+    const quint32 rootSize =
+        qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(buffer.constData() + from + binaryHeaderSize));
+    if (rootSize > quint32(0x7fffffff - binaryHeaderSize - from))
+        return -1;
+
+    return binaryHeaderSize + rootSize;
+}
+
+bool QJsonRpcSocketPrivate::isBinaryDocument(const char *data, int size)
+{
+    return size >= binaryHeaderSize + 4 && memcmp(data, binaryTag, sizeof(binaryTag)) == 0;
+}
+
+void QJsonRpcSocketPrivate::compactBuffer()
+{
+    if (readOffset == 0)
+        return;
+
+    if (readOffset == buffer.size()) {
+        buffer.clear();
+        readOffset = 0;
+        frameSize = -1;
+        resetFramingState();
+        return;
+    }
+
+    // only move the unread tail once most of the buffer has been consumed
+    if (readOffset < buffer.size() / 2)
+        return;
+
+    buffer.remove(0, readOffset);
+    if (scanDepth > 0) {
+        documentStart -= readOffset;
+        if (escapedPosition >= 0)
+            escapedPosition -= readOffset;
     }
+    if (frameSize != -1)
+        framePayloadStart -= readOffset;
+    scanPosition = qMax(0, scanPosition - readOffset);
+    readOffset = 0;
 }
 
 void QJsonRpcSocket::processRequestMessage(const QJsonRpcMessage &message)
@@ -39,13 +39,40 @@ public:
     void setWireFormat(QJsonDocument::JsonFormat format);
 #endif
 
+    QJsonRpc::Framing framing() const;
+    void setFraming(QJsonRpc::Framing framing);
+
+    QJsonRpc::Encoding encoding() const;
+    void setEncoding(QJsonRpc::Encoding encoding);
+
+    // read only the envelope of incoming requests, see QJsonRpcMessage::fromEnvelope
+    bool isLazyParsingEnabled() const;
+    void setLazyParsingEnabled(bool enabled);
+
+    // gather outgoing messages, written once per event loop pass or threshold
+    bool isWriteCoalescingEnabled() const;
+    void setWriteCoalescingEnabled(bool enabled);
+    int writeCoalescingThreshold() const;
+    void setWriteCoalescingThreshold(int bytes);
+
+    qint64 flushCount() const;
+    qint64 flushedBytes() const;
+
+    // stop reading from the peer while more than highWaterMark bytes are unsent
+    qint64 highWaterMark() const;
+    void setHighWaterMark(qint64 bytes);
+    qint64 lowWaterMark() const;
+    void setLowWaterMark(qint64 bytes);
+    bool isCongested() const;
+
     bool isValid() const;
 
 public Q_SLOTS:
     virtual void notify(const QJsonRpcMessage &message);
+    void flush();
     QJsonRpcMessage sendMessageBlocking(const QJsonRpcMessage &message, int msecs = 30000);
     QJsonRpcServiceReply *sendMessage(const QJsonRpcMessage &message);
-//  void sendMessage(const QList<QJsonRpcMessage> &bulk);
+    QList<QJsonRpcServiceReply*> sendMessages(const QList<QJsonRpcMessage> &messages);
     QJsonRpcMessage invokeRemoteMethodBlocking(const QString &method, const QVariant &arg1 = QVariant(),
                                                const QVariant &arg2 = QVariant(), const QVariant &arg3 = QVariant(),
                                                const QVariant &arg4 = QVariant(), const QVariant &arg5 = QVariant(),
@@ -61,6 +88,8 @@ public Q_SLOTS:
 
 Q_SIGNALS:
     void messageReceived(const QJsonRpcMessage &message);
+    void highWaterMarkReached();
+    void lowWaterMarkReached();
 
 protected:
     QJsonRpcSocket(QJsonRpcSocketPrivate &dd, QObject *parent);
@@ -71,6 +100,9 @@ private:
     Q_DISABLE_COPY(QJsonRpcSocket)
 
     Q_PRIVATE_SLOT(d_func(), void _q_processIncomingData())
+    Q_PRIVATE_SLOT(d_func(), void _q_flushOutgoingData())
+    Q_PRIVATE_SLOT(d_func(), void _q_updateBackpressure())
+    Q_PRIVATE_SLOT(d_func(), void _q_abortDevice())
 };
 
 class QJSONRPC_EXPORT QJsonRpcServiceSocket : public QJsonRpcSocket,
@@ -21,18 +21,45 @@
 
 #include <QPointer>
 #include <QHash>
+#include <QMutex>
+#include <QSharedData>
+#include <QAtomicInt>
 #include <QIODevice>
 
 #if QT_VERSION >= 0x050000
 #include <QJsonDocument>
+#include <QJsonArray>
 #else
 #include "json/qjsondocument.h"
+#include "json/qjsonarray.h"
 #endif
 
 #include "qjsonrpcsocket.h"
 #include "qjsonrpcmessage.h"
 #include "qjsonrpc_export.h"
 
+// QJsonDocument::toBinaryData() and fromBinaryData() are deprecated in Qt 5.15
+#if QT_VERSION < 0x050F00
+#define QJSONRPC_HAVE_BINARY_JSON
+#endif
+
+/*
+ * Lets other threads hand messages to a socket without touching it once it
+ * is gone: the socket clears the pointer under the mutex when destroyed, and
+ * anything posted while it was set is discarded along with the socket.
+ */
+class QJsonRpcSocketHandle : public QSharedData
+{
+public:
+    explicit QJsonRpcSocketHandle(QJsonRpcSocket *socket) : socket(socket) {}
+
+    // sends message from any thread, false if the socket is gone
+    bool notify(const QJsonRpcMessage &message);
+
+    QMutex mutex;
+    QJsonRpcSocket *socket;
+};
+
 class QJsonRpcServiceReply;
 class QJSONRPC_EXPORT QJsonRpcSocketPrivate : public QObjectPrivate
 {
@@ -41,21 +68,154 @@ class QJSONRPC_EXPORT QJsonRpcSocketPrivate : public QObjectPrivate
 public:
 #if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
     QJsonDocument::JsonFormat format;
-    QJsonRpcSocketPrivate() : format(QJsonDocument::Compact) {}
-#else
-    QJsonRpcSocketPrivate() {}
 #endif
 
+    QJsonRpcSocketPrivate()
+        : framing(QJsonRpc::StreamFraming),
+          encoding(QJsonRpc::TextEncoding),
+          lazyParsing(false),
+          peerSentBinary(false),
+          coalesceWrites(false),
+          coalescingThreshold(64 * 1024),
+          flushScheduled(false),
+          flushCount(0),
+          flushedBytes(0),
+          highWaterMark(0),
+          lowWaterMark(0),
+          congested(false),
+          savedReadBufferSize(0),
+          readOffset(0),
+          frameSize(-1),
+          framePayloadStart(0),
+          scanPosition(0),
+          scanDepth(0),
+          scanInString(false),
+          escapedPosition(-1),
+          blockStart(0),
+          blockEnd(0),
+          documentStart(0)
+    {
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+        format = QJsonDocument::Compact;
+#endif
+        // reserved capacity survives resize(0), the buffer is reused
+        serializeBuffer.reserve(1024);
+        publishState();
+    }
+
+    // for the servers, without making them friends of the public class
+    static const QJsonRpcSocketPrivate *get(const QJsonRpcSocket *socket) { return socket->d_func(); }
+
     // slots
     virtual void _q_processIncomingData();
+    void _q_flushOutgoingData();
+    void _q_updateBackpressure();
+    void _q_abortDevice();
+
+    /*
+     * Resumable: if no complete document is found the scanner state is kept,
+     * and the next call only scans the bytes appended to jsonData since.
+     * The state is reset once a document end has been returned.
+     */
+    int findJsonDocumentEnd(const QByteArray &jsonData, int from = 0);
+
+    // structural character scanner used by findJsonDocumentEnd, picked at runtime
+    enum ScannerImplementation {
+        ScalarScanner,
+        Sse2Scanner,
+        Avx2Scanner
+    };
+    static ScannerImplementation scannerImplementation();
+    static bool setScannerImplementation(ScannerImplementation implementation);
+
+    void resetFramingState();
+    bool nextFrame(int *payloadStart, int *payloadSize);
+    bool readFrameHeader();
 
-    int findJsonDocumentEnd(const QByteArray &jsonData);
+    // size of the binary document starting at from, 0 if incomplete, -1 if none
+    int binaryDocumentSize(int from) const;
+    static bool isBinaryDocument(const char *data, int size);
+    void compactBuffer();
+    void processMessage(const QJsonRpcMessage &message);
+    void processBatch(const QJsonArray &batch);
     void writeData(const QJsonRpcMessage &message);
+    void writeDocument(const QJsonDocument &document);
+    void writePayload(const QByteArray &payload);
+
+    // identifies the bytes encode() produces, payloads with the same key are interchangeable
+    int encodingKey() const;
+    bool writesBinary() const;
+    // encoding, or TextEncoding with a warning if binary is not available
+    static QJsonRpc::Encoding supportedEncoding(QJsonRpc::Encoding encoding);
+    // messages can be serialized straight into the payload, see writeData()
+    bool writesCompactText() const;
+    QByteArray encode(const QJsonDocument &document) const;
+    static QByteArray encode(const QJsonDocument &document, int key);
+
+    /*
+     * The encoding key and congestion as last seen by the socket's own thread,
+     * for servers notifying clients that live in a worker thread. Updated by
+     * publishState() whenever framing, encoding, format or congestion change.
+     */
+    void publishState();
+    int sharedEncodingKey() const;
+    bool isSharedCongested() const;
+    void writeFrame(const QByteArray &payload);
+    void writeRaw(const QByteArray &data);
+
+    qint64 pendingBytes() const;
+    void pauseReading();
+    void resumeReading();
 
     QPointer<QIODevice> device;
+    QExplicitlySharedDataPointer<QJsonRpcSocketHandle> handle;
+    QJsonRpc::Framing framing;
+    QJsonRpc::Encoding encoding;
+    bool lazyParsing;
+    bool peerSentBinary;    // for MatchPeerEncoding
+
+    // a received batch whose answers are not all in yet, see processBatch()
+    struct PendingBatch {
+        QHash<int, int> ids;    // ids of the batch's requests, with answers still expected
+        QJsonArray responses;
+    };
+    QList<PendingBatch> pendingBatches;
+    bool collectBatchResponse(const QJsonRpcMessage &message);
+
+    // compact text of the message being written, see writeData()
+    QByteArray serializeBuffer;
+
+    // outgoing frames not yet written to the device
+    QByteArray outgoing;
+    bool coalesceWrites;
+    int coalescingThreshold;
+    bool flushScheduled;
+    qint64 flushCount;
+    qint64 flushedBytes;
+
+    // backpressure, disabled while highWaterMark is 0
+    qint64 highWaterMark;
+    qint64 lowWaterMark;
+    bool congested;
+    qint64 savedReadBufferSize;
+    QAtomicInt sharedKey;
+    QAtomicInt sharedCongested;
+
     QByteArray buffer;
+    int readOffset;     // start of the unconsumed data in buffer
+    int frameSize;      // payload size announced by a frame header, -1 if none
+    int framePayloadStart;
     QHash<int, QPointer<QJsonRpcServiceReply> > replies;
 
+    // framing state, kept across reads
+    int scanPosition;
+    int scanDepth;
+    bool scanInString;
+    int escapedPosition;
+    char blockStart;
+    char blockEnd;
+    int documentStart;
+
 };
 
 #endif
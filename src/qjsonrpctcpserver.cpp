@@ -1,5 +1,18 @@
 #include <QTcpSocket>
 
+#if defined(Q_OS_LINUX)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#if defined(SO_REUSEPORT)
+#define QJSONRPC_HAVE_REUSEPORT
+#endif
+#endif
+
 #include "qjsonrpctcpserver.h"
 #include "qjsonrpctcpserver_p.h"
 
@@ -16,22 +29,371 @@ QJsonRpcTcpServer::QJsonRpcTcpServer(QJsonRpcTcpServerPrivate &dd, QObject *pare
 QJsonRpcTcpServer::~QJsonRpcTcpServer()
 {
     Q_D(QJsonRpcTcpServer);
+    d->stopWorkers();
     foreach (QTcpSocket *socket, d->socketLookup.keys())
         socket->deleteLater();
     d->socketLookup.clear();
 }
 
+int QJsonRpcTcpServer::workerThreadCount() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->workerThreadCount;
+}
+
+void QJsonRpcTcpServer::setWorkerThreadCount(int count)
+{
+    Q_D(QJsonRpcTcpServer);
+    if (!d->workers.isEmpty()) {
+        qDebug() << Q_FUNC_INFO << "worker threads are already running";
+        return;
+    }
+
+    d->workerThreadCount = qMax(0, count);
+}
+
+QJsonRpcTcpServer::LoadBalancing QJsonRpcTcpServer::loadBalancing() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    return d->loadBalancing;
+}
+
+void QJsonRpcTcpServer::setLoadBalancing(LoadBalancing policy)
+{
+    Q_D(QJsonRpcTcpServer);
+    d->loadBalancing = policy;
+}
+
 bool QJsonRpcTcpServer::listen(const QHostAddress &address, quint16 port)
 {
     Q_D(QJsonRpcTcpServer);
+    if (d->loadBalancing == ReusePort && d->workerThreadCount > 0) {
+#if defined(QJSONRPC_HAVE_REUSEPORT)
+        return d->listenReusePort(address, port);
+#else
+        d->errorString = QLatin1String("SO_REUSEPORT is not supported on this platform");
+        return false;
+#endif
+    }
+
     if (!d->server) {
-        d->server = new QTcpServer(this);
+        d->server = new QJsonRpcTcpServerListener(d, this);
         connect(d->server, SIGNAL(newConnection()), this, SLOT(_q_processIncomingConnection()));
     }
 
+    if (d->workers.isEmpty())
+        d->startWorkers();
+    d->errorString.clear();
     return d->server->listen(address, port);
 }
 
+#if QT_VERSION >= 0x050000
+void QJsonRpcTcpServerListener::incomingConnection(qintptr socketDescriptor)
+#else
+void QJsonRpcTcpServerListener::incomingConnection(int socketDescriptor)
+#endif
+{
+    if (server->workers.isEmpty())
+        QTcpServer::incomingConnection(socketDescriptor);
+    else
+        server->dispatchConnection(socketDescriptor);
+}
+
+QJsonRpcTcpServerWorker::QJsonRpcTcpServerWorker(QJsonRpcTcpServerPrivate *server)
+    : QObject(0),
+      connectionCount(0),
+      server(server),
+      listener(0)
+{
+}
+
+void QJsonRpcTcpServerWorker::addConnection(qlonglong socketDescriptor)
+{
+    QTcpSocket *tcpSocket = new QTcpSocket;
+    if (!tcpSocket->setSocketDescriptor(socketDescriptor)) {
+        qDebug() << Q_FUNC_INFO << "unable to take over connection:" << tcpSocket->errorString();
+        delete tcpSocket;
+        Q_EMIT clientConnected(0);
+        return;
+    }
+
+    addSocket(tcpSocket);
+}
+
+void QJsonRpcTcpServerWorker::listen(qlonglong socketDescriptor)
+{
+    // accepts on a listening socket of its own, see QJsonRpcTcpServer::ReusePort
+    if (!listener) {
+        listener = new QTcpServer(this);
+        connect(listener, SIGNAL(newConnection()), this, SLOT(processIncomingConnections()));
+    }
+
+    if (!listener->setSocketDescriptor(socketDescriptor))
+        qDebug() << Q_FUNC_INFO << "unable to take over listener:" << listener->errorString();
+}
+
+void QJsonRpcTcpServerWorker::processIncomingConnections()
+{
+    while (QTcpSocket *tcpSocket = listener->nextPendingConnection())
+        addSocket(tcpSocket);
+}
+
+void QJsonRpcTcpServerWorker::addSocket(QTcpSocket *tcpSocket)
+{
+    QJsonRpcSocket *socket = server->createSocket(tcpSocket, this);
+    server->setupSocket(socket);
+
+    connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
+              this, SLOT(processMessage(QJsonRpcMessage)));
+    connect(tcpSocket, SIGNAL(disconnected()), this, SLOT(processDisconnect()));
+    socketLookup.insert(tcpSocket, socket);
+    Q_EMIT clientConnected(socket);
+}
+
+void QJsonRpcTcpServerWorker::processMessage(const QJsonRpcMessage &message)
+{
+    QJsonRpcSocket *socket = static_cast<QJsonRpcSocket*>(sender());
+    if (!socket) {
+        qDebug() << Q_FUNC_INFO << "called without service socket";
+        return;
+    }
+
+    // subscriptions are bookkept by the server, in its own thread
+    const QString method = message.method();
+    if (method == QLatin1String("rpc.subscribe") || method == QLatin1String("rpc.unsubscribe")) {
+        Q_EMIT subscriptionReceived(socket, message);
+        return;
+    }
+
+    server->processWorkerMessage(socket, message);
+}
+
+void QJsonRpcTcpServerWorker::processDisconnect()
+{
+    QTcpSocket *tcpSocket = static_cast<QTcpSocket*>(sender());
+    if (!tcpSocket || !socketLookup.contains(tcpSocket))
+        return;
+
+    // the server deletes the socket once it is out of its client list
+    Q_EMIT clientDisconnected(socketLookup.take(tcpSocket));
+}
+
+int QJsonRpcTcpServerPrivate::qjsonRpcSocketType = qRegisterMetaType<QJsonRpcSocket*>("QJsonRpcSocket*");
+QJsonRpcSocket *QJsonRpcTcpServerPrivate::createSocket(QTcpSocket *tcpSocket, QObject *parent) const
+{
+    QJsonRpcSocket *socket = new QJsonRpcSocket(tcpSocket, parent);
+    tcpSocket->setParent(socket);
+    return socket;
+}
+
+void QJsonRpcTcpServerPrivate::setupSocket(QJsonRpcSocket *socket) const
+{
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+    socket->setWireFormat(format);
+#endif
+    socket->setFraming(framing);
+    socket->setEncoding(encoding);
+    socket->setLazyParsingEnabled(lazyParsing);
+    socket->setHighWaterMark(highWaterMark);
+    socket->setLowWaterMark(lowWaterMark);
+}
+
+void QJsonRpcTcpServerPrivate::startWorkers()
+{
+    Q_Q(QJsonRpcTcpServer);
+    for (int i = 0; i < workerThreadCount; ++i) {
+        QThread *thread = new QThread(q);
+        QJsonRpcTcpServerWorker *worker = new QJsonRpcTcpServerWorker(this);
+        worker->moveToThread(thread);
+        QObject::connect(thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+        QObject::connect(worker, SIGNAL(clientConnected(QJsonRpcSocket*)),
+                              q, SLOT(_q_workerClientConnected(QJsonRpcSocket*)));
+        QObject::connect(worker, SIGNAL(clientDisconnected(QJsonRpcSocket*)),
+                              q, SLOT(_q_workerClientDisconnected(QJsonRpcSocket*)));
+        QObject::connect(worker, SIGNAL(subscriptionReceived(QJsonRpcSocket*,QJsonRpcMessage)),
+                              q, SLOT(_q_workerSubscriptionReceived(QJsonRpcSocket*,QJsonRpcMessage)));
+        thread->start();
+
+        workerThreads.append(thread);
+        workers.append(worker);
+    }
+}
+
+void QJsonRpcTcpServerPrivate::stopWorkers()
+{
+    Q_Q(QJsonRpcTcpServer);
+
+    // worker sockets go away with their thread, don't leave them behind
+    for (int i = clients.size() - 1; i >= 0; --i) {
+        if (clients.at(i)->thread() != q->thread())
+            removeClient(clients.at(i));
+    }
+
+    foreach (QThread *thread, workerThreads) {
+        thread->quit();
+        thread->wait();
+    }
+
+    qDeleteAll(workerThreads);
+    workerThreads.clear();
+    workers.clear();
+}
+
+void QJsonRpcTcpServerPrivate::dispatchConnection(qlonglong socketDescriptor)
+{
+    QJsonRpcTcpServerWorker *worker = 0;
+    if (loadBalancing == QJsonRpcTcpServer::LeastConnections) {
+        worker = workers.first();
+        for (int i = 1; i < workers.size(); ++i) {
+            if (workers.at(i)->connectionCount < worker->connectionCount)
+                worker = workers.at(i);
+        }
+    } else {
+        worker = workers.at(nextWorker);
+        nextWorker = (nextWorker + 1) % workers.size();
+    }
+
+    worker->connectionCount++;
+    QMetaObject::invokeMethod(worker, "addConnection", Qt::QueuedConnection,
+                              Q_ARG(qlonglong, socketDescriptor));
+}
+
+bool QJsonRpcTcpServerPrivate::listenReusePort(const QHostAddress &address, quint16 port)
+{
+#if defined(QJSONRPC_HAVE_REUSEPORT)
+    if (workers.isEmpty())
+        startWorkers();
+
+    // open them all first, a port of 0 is resolved by the first one
+    QList<int> descriptors;
+    for (int i = 0; i < workers.size(); ++i) {
+        int descriptor = openReusePortListener(address, port);
+        if (descriptor == -1) {
+            foreach (int opened, descriptors)
+                ::close(opened);
+            return false;
+        }
+
+        descriptors.append(descriptor);
+    }
+
+    errorString.clear();
+    reusePort = port;
+    for (int i = 0; i < workers.size(); ++i)
+        QMetaObject::invokeMethod(workers.at(i), "listen", Qt::QueuedConnection,
+                                  Q_ARG(qlonglong, descriptors.at(i)));
+    return true;
+#else
+    Q_UNUSED(address)
+    Q_UNUSED(port)
+    return false;
+#endif
+}
+
+int QJsonRpcTcpServerPrivate::openReusePortListener(const QHostAddress &address, quint16 &port)
+{
+#if defined(QJSONRPC_HAVE_REUSEPORT)
+    sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    socklen_t length;
+
+    bool anyAddress = false;
+#if QT_VERSION >= 0x050000
+    anyAddress = (address.protocol() == QAbstractSocket::AnyIPProtocol);
+#endif
+    if (anyAddress || address.protocol() == QAbstractSocket::IPv6Protocol) {
+        sockaddr_in6 *in6 = reinterpret_cast<sockaddr_in6*>(&storage);
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        if (!anyAddress) {
+            Q_IPV6ADDR ip6 = address.toIPv6Address();
+            memcpy(&in6->sin6_addr, &ip6, sizeof(ip6));
+        }
+        length = sizeof(sockaddr_in6);
+    } else {
+        sockaddr_in *in4 = reinterpret_cast<sockaddr_in*>(&storage);
+        in4->sin_family = AF_INET;
+        in4->sin_port = htons(port);
+        in4->sin_addr.s_addr = htonl(address.toIPv4Address());
+        length = sizeof(sockaddr_in);
+    }
+
+    int descriptor = ::socket(storage.ss_family, SOCK_STREAM, 0);
+    if (descriptor == -1) {
+        errorString = QString::fromLocal8Bit(strerror(errno));
+        return -1;
+    }
+
+    int on = 1;
+    int off = 0;
+    if ((anyAddress && ::setsockopt(descriptor, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) == -1) ||
+        ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+        ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1 ||
+        ::bind(descriptor, reinterpret_cast<sockaddr*>(&storage), length) == -1 ||
+        ::listen(descriptor, 50) == -1) {
+        errorString = QString::fromLocal8Bit(strerror(errno));
+        ::close(descriptor);
+        return -1;
+    }
+
+    if (port == 0) {
+        if (::getsockname(descriptor, reinterpret_cast<sockaddr*>(&storage), &length) == 0) {
+            port = ntohs(storage.ss_family == AF_INET6 ?
+                         reinterpret_cast<sockaddr_in6*>(&storage)->sin6_port :
+                         reinterpret_cast<sockaddr_in*>(&storage)->sin_port);
+        }
+    }
+
+    return descriptor;
+#else
+    Q_UNUSED(address)
+    Q_UNUSED(port)
+    return -1;
+#endif
+}
+
+void QJsonRpcTcpServerPrivate::processWorkerMessage(QJsonRpcSocket *socket,
+                                                    const QJsonRpcMessage &message)
+{
+    // runs in the worker thread, services living elsewhere get the request queued
+    Q_Q(QJsonRpcTcpServer);
+    q->processMessage(socket, message);
+}
+
+void QJsonRpcTcpServerPrivate::_q_workerClientConnected(QJsonRpcSocket *socket)
+{
+    Q_Q(QJsonRpcTcpServer);
+    if (!socket) {
+        _q_workerClientDisconnected(socket);
+        return;
+    }
+
+    // with ReusePort the kernel picked the worker, count it only now
+    QJsonRpcTcpServerWorker *worker = qobject_cast<QJsonRpcTcpServerWorker*>(q->sender());
+    if (worker && loadBalancing == QJsonRpcTcpServer::ReusePort)
+        worker->connectionCount++;
+    clients.append(socket);
+}
+
+void QJsonRpcTcpServerPrivate::_q_workerClientDisconnected(QJsonRpcSocket *socket)
+{
+    Q_Q(QJsonRpcTcpServer);
+    QJsonRpcTcpServerWorker *worker = qobject_cast<QJsonRpcTcpServerWorker*>(q->sender());
+    if (worker)
+        worker->connectionCount--;
+
+    if (socket) {
+        removeClient(socket);
+        socket->deleteLater();
+    }
+}
+
+void QJsonRpcTcpServerPrivate::_q_workerSubscriptionReceived(QJsonRpcSocket *socket,
+                                                             const QJsonRpcMessage &message)
+{
+    processSubscription(socket, message);
+}
+
 void QJsonRpcTcpServerPrivate::_q_processIncomingConnection()
 {
     Q_Q(QJsonRpcTcpServer);
@@ -41,11 +403,8 @@ void QJsonRpcTcpServerPrivate::_q_processIncomingConnection()
         return;
     }
 
-    QIODevice *device = qobject_cast<QIODevice*>(tcpSocket);
-    QJsonRpcSocket *socket = new QJsonRpcSocket(device, q);
-#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
-    socket->setWireFormat(format);
-#endif
+    QJsonRpcSocket *socket = createSocket(tcpSocket, q);
+    setupSocket(socket);
 
     QObject::connect(socket, SIGNAL(messageReceived(QJsonRpcMessage)),
                           q, SLOT(_q_processMessage(QJsonRpcMessage)));
@@ -59,19 +418,30 @@ void QJsonRpcTcpServerPrivate::_q_clientDisconnected()
     Q_Q(QJsonRpcTcpServer);
     QTcpSocket *tcpSocket = static_cast<QTcpSocket*>(q->sender());
     if (tcpSocket) {
+        // the tcp socket goes away with the rpc socket that owns it
         if (socketLookup.contains(tcpSocket)) {
             QJsonRpcSocket *socket = socketLookup.take(tcpSocket);
-            clients.removeAll(socket);
+            removeClient(socket);
             socket->deleteLater();
+        } else {
+            tcpSocket->deleteLater();
         }
-
-        tcpSocket->deleteLater();
     }
 }
 
+quint16 QJsonRpcTcpServer::serverPort() const
+{
+    Q_D(const QJsonRpcTcpServer);
+    if (d->reusePort)
+        return d->reusePort;
+    return d->server ? d->server->serverPort() : 0;
+}
+
 QString QJsonRpcTcpServer::errorString() const
 {
     Q_D(const QJsonRpcTcpServer);
+    if (!d->errorString.isEmpty() || !d->server)
+        return d->errorString;
     return d->server->errorString();
 }
 
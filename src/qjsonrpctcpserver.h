@@ -32,6 +32,25 @@ public:
     QString errorString() const;
     bool listen(const QHostAddress &address, quint16 port);
 
+    // the port listened on, the one picked by the system if listen() was given 0
+    quint16 serverPort() const;
+
+    // spread accepted connections over count threads with their own event
+    // loop, 0 (the default) keeps every client in this thread. Services are
+    // always called in the thread they live in. Must be set before listen()
+    int workerThreadCount() const;
+    void setWorkerThreadCount(int count);
+
+    // ReusePort opens one SO_REUSEPORT listener per worker and lets the
+    // kernel balance accepts; where that is unsupported listen() fails
+    enum LoadBalancing {
+        RoundRobin,
+        LeastConnections,
+        ReusePort
+    };
+    LoadBalancing loadBalancing() const;
+    void setLoadBalancing(LoadBalancing policy);
+
 protected:
     explicit QJsonRpcTcpServer(QJsonRpcTcpServerPrivate &dd, QObject *parent);
 
@@ -39,6 +58,9 @@ protected:
     Q_DISABLE_COPY(QJsonRpcTcpServer)
     Q_PRIVATE_SLOT(d_func(), void _q_processIncomingConnection())
     Q_PRIVATE_SLOT(d_func(), void _q_clientDisconnected())
+    Q_PRIVATE_SLOT(d_func(), void _q_workerClientConnected(QJsonRpcSocket *socket))
+    Q_PRIVATE_SLOT(d_func(), void _q_workerClientDisconnected(QJsonRpcSocket *socket))
+    Q_PRIVATE_SLOT(d_func(), void _q_workerSubscriptionReceived(QJsonRpcSocket *socket, const QJsonRpcMessage &message))
 
 };
 
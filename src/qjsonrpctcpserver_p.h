@@ -1,22 +1,110 @@
 
 #include <QTcpServer>
+#include <QThread>
 
 #include "qjsonrpcsocket.h"
+#include "qjsonrpctcpserver.h"
 #include "qjsonrpcabstractserver_p.h"
 
+class QJsonRpcTcpServerPrivate;
+
+// hands accepted descriptors to the worker threads, if there are any
+class QJsonRpcTcpServerListener : public QTcpServer
+{
+public:
+    QJsonRpcTcpServerListener(QJsonRpcTcpServerPrivate *server, QObject *parent)
+        : QTcpServer(parent),
+          server(server)
+    {
+    }
+
+protected:
+#if QT_VERSION >= 0x050000
+    virtual void incomingConnection(qintptr socketDescriptor);
+#else
+    virtual void incomingConnection(int socketDescriptor);
+#endif
+
+private:
+    QJsonRpcTcpServerPrivate *server;
+};
+
+// owns the sockets of one worker thread, lives in that thread
+class QJsonRpcTcpServerWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QJsonRpcTcpServerWorker(QJsonRpcTcpServerPrivate *server);
+
+    // only touched from the server's thread
+    int connectionCount;
+
+public Q_SLOTS:
+    void addConnection(qlonglong socketDescriptor);
+    void listen(qlonglong socketDescriptor);
+
+Q_SIGNALS:
+    // socket is 0 if the descriptor could not be taken over
+    void clientConnected(QJsonRpcSocket *socket);
+    void clientDisconnected(QJsonRpcSocket *socket);
+    void subscriptionReceived(QJsonRpcSocket *socket, const QJsonRpcMessage &message);
+
+private Q_SLOTS:
+    void processMessage(const QJsonRpcMessage &message);
+    void processDisconnect();
+    void processIncomingConnections();
+
+private:
+    void addSocket(QTcpSocket *tcpSocket);
+
+    QJsonRpcTcpServerPrivate *server;
+    QTcpServer *listener;
+    QHash<QTcpSocket*, QJsonRpcSocket*> socketLookup;
+
+};
+
 class QJsonRpcTcpServerPrivate : public QJsonRpcAbstractServerPrivate
 {
     Q_DECLARE_PUBLIC(QJsonRpcTcpServer)
 public:
     QJsonRpcTcpServerPrivate()
-        : server(0)
+        : server(0),
+          workerThreadCount(0),
+          loadBalancing(QJsonRpcTcpServer::RoundRobin),
+          nextWorker(0),
+          reusePort(0)
     {
     }
 
     virtual void _q_processIncomingConnection();
     virtual void _q_clientDisconnected();
+    void _q_workerClientConnected(QJsonRpcSocket *socket);
+    void _q_workerClientDisconnected(QJsonRpcSocket *socket);
+    void _q_workerSubscriptionReceived(QJsonRpcSocket *socket, const QJsonRpcMessage &message);
 
-    QTcpServer *server;
+    void startWorkers();
+    void stopWorkers();
+    void dispatchConnection(qlonglong socketDescriptor);
+    bool listenReusePort(const QHostAddress &address, quint16 port);
+    int openReusePortListener(const QHostAddress &address, quint16 &port);
+    void processWorkerMessage(QJsonRpcSocket *socket, const QJsonRpcMessage &message);
+    // wraps an accepted connection, the returned socket owns tcpSocket; called
+    // from the worker threads too, so it must not touch the server's state
+    virtual QJsonRpcSocket *createSocket(QTcpSocket *tcpSocket, QObject *parent) const;
+    // applies the server's wire format, framing, encoding, lazy parsing and
+    // water marks to a new client socket, whatever kind of server made it
+    void setupSocket(QJsonRpcSocket *socket) const;
+    static int qjsonRpcSocketType;
+
+    QJsonRpcTcpServerListener *server;
     QHash<QTcpSocket*, QJsonRpcSocket*> socketLookup;
+    QString errorString;
+
+    int workerThreadCount;
+    QJsonRpcTcpServer::LoadBalancing loadBalancing;
+    QList<QThread*> workerThreads;
+    QList<QJsonRpcTcpServerWorker*> workers;
+    int nextWorker;
+    quint16 reusePort;  // bound by listenReusePort, 0 while not listening that way
 };
 
@@ -20,9 +20,11 @@ lessThan(QT_VERSION_MAJOR, 5) {
 }
 
 PRIVATE_HEADERS += \
+    qjsonrpcmessage_p.h \
     qjsonrpcservice_p.h \
     qjsonrpcsocket_p.h \
     qjsonrpcabstractserver_p.h \
+    qjsonrpctcpserver_p.h \
     qjsonrpcservicereply_p.h
 
 INSTALL_HEADERS += \
@@ -34,6 +36,8 @@ INSTALL_HEADERS += \
     qjsonrpctcpserver.h \
     qjsonrpc_export.h \
     qjsonrpcservicereply.h \
+    qjsonrpcservicerequest.h \
+    qjsonrpcmethod.h \
     qjsonrpchttpclient.h
 
 SOURCES += \
@@ -44,6 +48,8 @@ SOURCES += \
     qjsonrpclocalserver.cpp \
     qjsonrpctcpserver.cpp \
     qjsonrpcservicereply.cpp \
+    qjsonrpcservicerequest.cpp \
+    qjsonrpcmethod.cpp \
     qjsonrpchttpclient.cpp
 
 http_server {
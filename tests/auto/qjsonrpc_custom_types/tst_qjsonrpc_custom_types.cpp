@@ -52,6 +52,7 @@ private slots:
     void testInvalidParams();
     void testEnums();
     void testCommonMethodName();
+    void testAlignedParams();
 };
 
 class CustomClass : public QObject
@@ -116,6 +117,28 @@ public:
 
 Q_DECLARE_METATYPE(AnotherCustomClass)
 
+class Q_DECL_ALIGN(16) AlignedClass
+{
+public:
+    explicit AlignedClass(int data = 0) :
+        data(data)
+    {}
+
+    QJsonValue toJson() const
+    {
+        return QJsonValue(data);
+    }
+
+    static AlignedClass fromJson(const QJsonValue &value)
+    {
+        return AlignedClass(int(value.toDouble()));
+    }
+
+    int data;
+};
+
+Q_DECLARE_METATYPE(AlignedClass)
+
 class UnboundClass : public QObject
 {
 public:
@@ -176,6 +199,10 @@ public Q_SLOTS:
     QString testCommonMethodName(const AnotherCustomClass &c)
     { return c.data; }
 
+    bool testAlignedParams(const AlignedClass &param) const {
+        return (quintptr(&param) & 15) == 0 && param.data == 7;
+    }
+
 };
 
 Q_DECLARE_METATYPE(TestService::TestEnum)
@@ -241,6 +268,8 @@ void TestQJsonRpcCustomTypes::initTestCase()
     QMetaType::registerConverter<QJsonValue, TestService::TestEnum>(&fromJson);
     QMetaType::registerConverter(&AnotherCustomClass::toJson);
     QMetaType::registerConverter<QJsonValue, AnotherCustomClass>(&AnotherCustomClass::fromJson);
+    QMetaType::registerConverter(&AlignedClass::toJson);
+    QMetaType::registerConverter<QJsonValue, AlignedClass>(&AlignedClass::fromJson);
 #endif
 }
 
@@ -352,5 +381,22 @@ void TestQJsonRpcCustomTypes::testCommonMethodName()
     QCOMPARE(ac.data, QLatin1String("test string"));
 }
 
+/*
+ * Custom types get storage aligned for them, not just for the built-in types
+ */
+void TestQJsonRpcCustomTypes::testAlignedParams()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+
+    QJsonRpcMessage request =
+        QJsonRpcMessage::createRequest("service.testAlignedParams",
+                                       AlignedClass(7).toJson());
+    QVERIFY(service.testDispatch(request));
+    QCOMPARE(provider.last.type(), QJsonRpcMessage::Response);
+    QCOMPARE(provider.last.result().toBool(), true);
+}
+
 QTEST_MAIN(TestQJsonRpcCustomTypes)
 #include "tst_qjsonrpc_custom_types.moc"
@@ -8,6 +8,7 @@
 #include <QSslConfiguration>
 
 #include "json/qjsondocument.h"
+#include "json/qjsonarray.h"
 #include "qjsonrpchttpserver.h"
 #include "qjsonrpcmessage.h"
 #include "qjsonrpcservice.h"
@@ -23,6 +24,10 @@ private Q_SLOTS:
 
     void quickTest();
     void sslTest();
+    void batchTest();
+    void notificationBatchTest();
+    void parseErrorTest();
+    void workerThreadsTest();
 
 private:
     QSslConfiguration serverSslConfiguration;
@@ -210,5 +215,152 @@ void TestQJsonRpcHttpServer::sslTest()
     reply->deleteLater();
 }
 
+void TestQJsonRpcHttpServer::batchTest()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    server.listen(QHostAddress::LocalHost, 8118);
+
+    QJsonArray batch;
+    batch.append(QJsonRpcMessage::createRequest("service.singleParam", QString("one")).toObject());
+    batch.append(QJsonRpcMessage::createNotification("service.increaseCalled").toObject());
+    batch.append(QJsonRpcMessage::createRequest("service.singleParam", QString("two")).toObject());
+    QJsonDocument document(batch);
+
+    QUrl requestUrl;
+    requestUrl.setScheme("http");
+    requestUrl.setHost("127.0.0.1");
+    requestUrl.setPort(8118);
+    QNetworkRequest request(requestUrl);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json-rpc");
+    request.setRawHeader("Accept", "application/json-rpc");
+
+    QNetworkAccessManager manager;
+    QNetworkReply *reply = manager.post(request, document.toJson());
+
+    QEventLoop loop;
+    connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    loop.exec();
+
+    // both responses in one array, nothing for the notification
+    QCOMPARE(200, reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+    QJsonDocument doc = QJsonDocument::fromJson(reply->readAll());
+    QVERIFY(doc.isArray());
+    QCOMPARE(doc.array().size(), 2);
+    QCOMPARE(QJsonRpcMessage(doc.array().at(0).toObject()).result().toString(), QString("one"));
+    QCOMPARE(QJsonRpcMessage(doc.array().at(1).toObject()).result().toString(), QString("two"));
+    reply->deleteLater();
+}
+
+void TestQJsonRpcHttpServer::notificationBatchTest()
+{
+    QJsonRpcHttpServer server;
+    TestService *service = new TestService;
+    server.addService(service);
+    server.listen(QHostAddress::LocalHost, 8118);
+
+    QJsonArray batch;
+    batch.append(QJsonRpcMessage::createNotification("service.increaseCalled").toObject());
+    batch.append(QJsonRpcMessage::createNotification("service.increaseCalled").toObject());
+    QJsonDocument document(batch);
+
+    QUrl requestUrl;
+    requestUrl.setScheme("http");
+    requestUrl.setHost("127.0.0.1");
+    requestUrl.setPort(8118);
+    QNetworkRequest request(requestUrl);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json-rpc");
+    request.setRawHeader("Accept", "application/json-rpc");
+
+    QNetworkAccessManager manager;
+    QNetworkReply *reply = manager.post(request, document.toJson());
+    QSignalSpy spyFinished(reply, SIGNAL(finished()));
+
+    QEventLoop loop;
+    connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    loop.exec();
+
+    // nothing to answer, but the request is still completed
+    QCOMPARE(spyFinished.count(), 1);
+    QCOMPARE(204, reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+    QVERIFY(reply->readAll().isEmpty());
+    QCOMPARE(service->callCount(), 2);
+    reply->deleteLater();
+}
+
+void TestQJsonRpcHttpServer::parseErrorTest()
+{
+    QJsonRpcHttpServer server;
+    server.addService(new TestService);
+    server.listen(QHostAddress::LocalHost, 8118);
+
+    QUrl requestUrl;
+    requestUrl.setScheme("http");
+    requestUrl.setHost("127.0.0.1");
+    requestUrl.setPort(8118);
+    QNetworkRequest request(requestUrl);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json-rpc");
+    request.setRawHeader("Accept", "application/json-rpc");
+
+    QNetworkAccessManager manager;
+    QNetworkReply *reply = manager.post(request, "{\"jsonrpc\": \"2.0\", \"method\": ");
+    QSignalSpy spyFinished(reply, SIGNAL(finished()));
+
+    QEventLoop loop;
+    connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    loop.exec();
+
+    // answered right away with an error, not left to time out
+    QCOMPARE(spyFinished.count(), 1);
+    QCOMPARE(500, reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+    QJsonDocument doc = QJsonDocument::fromJson(reply->readAll());
+    QVERIFY(doc.isObject());
+    QJsonRpcMessage error(doc.object());
+    QCOMPARE(error.type(), QJsonRpcMessage::Error);
+    QCOMPARE(error.errorCode(), int(QJsonRpc::ParseError));
+    reply->deleteLater();
+}
+
+void TestQJsonRpcHttpServer::workerThreadsTest()
+{
+    // the worker threads must speak HTTP too, not raw json
+    QJsonRpcHttpServer server;
+    server.setWorkerThreadCount(2);
+    server.addService(new TestService);
+    QVERIFY(server.listen(QHostAddress::LocalHost, 8118));
+
+    QUrl requestUrl;
+    requestUrl.setScheme("http");
+    requestUrl.setHost("127.0.0.1");
+    requestUrl.setPort(8118);
+    QNetworkRequest request(requestUrl);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json-rpc");
+    request.setRawHeader("Accept", "application/json-rpc");
+
+    QNetworkAccessManager manager;
+    for (int i = 0; i < 4; ++i) {
+        QJsonRpcMessage message =
+            QJsonRpcMessage::createRequest("service.singleParam", QString::number(i));
+        QNetworkReply *reply = manager.post(request, QJsonDocument(message.toObject()).toJson());
+
+        QEventLoop loop;
+        connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+        QTimer::singleShot(5000, &loop, SLOT(quit()));
+        loop.exec();
+
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QCOMPARE(200, reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+        QJsonDocument doc = QJsonDocument::fromJson(reply->readAll());
+        QVERIFY(doc.isObject());
+        QJsonRpcMessage response(doc.object());
+        QCOMPARE(response.id(), message.id());
+        QCOMPARE(response.result().toString(), QString::number(i));
+        reply->deleteLater();
+    }
+}
+
 QTEST_MAIN(TestQJsonRpcHttpServer)
 #include "tst_qjsonrpchttpserver.moc"
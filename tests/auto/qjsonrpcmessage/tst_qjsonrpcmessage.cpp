@@ -39,6 +39,10 @@ private slots:
     void equivalence_data();
     void equivalence();
     void withVariantListArgs();
+    void envelopeParsing_data();
+    void envelopeParsing();
+    void serialize_data();
+    void serialize();
 };
 
 void TestQJsonRpcMessage::invalidData()
@@ -225,5 +229,126 @@ void TestQJsonRpcMessage::withVariantListArgs()
     QCOMPARE(requestFromQJsonRpc, requestFromData);
 }
 
+void TestQJsonRpcMessage::envelopeParsing_data()
+{
+    QTest::addColumn<QByteArray>("json");
+
+    QTest::newRow("request") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"service.method\", \"params\": [42, \"a, ]}\"], \"id\": 1}");
+    QTest::newRow("named-params") << QByteArray(
+        "{\"id\": \"abc\", \"params\": {\"x\": {\"y\": [1, 2]}, \"z\": null}, \"method\": \"m\", \"jsonrpc\": \"2.0\"}");
+    QTest::newRow("notification") << QByteArray(
+        "{\"jsonrpc\":\"2.0\",\"method\":\"notify\",\"params\":[true,false,null,-1.5e3]}");
+    QTest::newRow("no-params") << QByteArray(
+        "  {\"jsonrpc\": \"2.0\", \"method\": \"m\", \"id\": 7}\n");
+    QTest::newRow("escaped-method") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"a\\\"b\", \"params\": [], \"id\": 1}");
+    QTest::newRow("response") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"result\": [1, 2], \"id\": 1}");
+    QTest::newRow("error") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"error\": {\"code\": -32601}, \"id\": 1}");
+    QTest::newRow("invalid") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"params\": [], \"id\": 666}");
+
+    // params that only look balanced are rejected with the whole message
+    QTest::newRow("mismatched-params") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"m\", \"params\": [1, 2}, \"id\": 1}");
+    QTest::newRow("malformed-params") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"m\", \"params\": [01, tru, \"\\q\"], \"id\": 1}");
+
+    // and so are strings that aren't well formed UTF-8
+    QTest::newRow("invalid-utf8") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"m\", \"params\": [\"a\xff\"], \"id\": 1}");
+    QTest::newRow("overlong-utf8") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"m\", \"params\": [\"\xc0\xaf\"], \"id\": 1}");
+    QTest::newRow("truncated-utf8") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"m\", \"params\": [\"\xe2\x82\"], \"id\": 1}");
+    QTest::newRow("surrogate-utf8") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"m\", \"params\": [\"\xed\xa0\x80\"], \"id\": 1}");
+    QTest::newRow("utf8") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"m\", \"params\": [\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"], \"id\": 1}");
+
+    // escaped surrogates are taken as they are, paired or not
+    QTest::newRow("lone-surrogate-escape") << QByteArray(
+        "{\"jsonrpc\": \"2.0\", \"method\": \"m\", \"params\": [\"\\ud800\"], \"id\": 1}");
+}
+
+void TestQJsonRpcMessage::envelopeParsing()
+{
+    QFETCH(QByteArray, json);
+
+    QJsonRpcMessage full(json);
+    QJsonRpcMessage lazy = QJsonRpcMessage::fromEnvelope(json);
+    QCOMPARE(lazy.type(), full.type());
+    QCOMPARE(lazy.id(), full.id());
+    QCOMPARE(lazy.method(), full.method());
+
+    // copies taken before and after params were parsed agree
+    QJsonRpcMessage copy(lazy);
+    QCOMPARE(lazy.params(), full.params());
+    QCOMPARE(copy.params(), full.params());
+    QCOMPARE(QJsonRpcMessage(lazy).params(), full.params());
+    QCOMPARE(lazy.toObject(), full.toObject());
+    QCOMPARE(lazy.result(), full.result());
+    QCOMPARE(lazy.errorCode(), full.errorCode());
+    QVERIFY(lazy == full);
+}
+
+void TestQJsonRpcMessage::serialize_data()
+{
+    QTest::addColumn<QJsonRpcMessage>("message");
+
+    QJsonArray params;
+    params.append(42);
+    params.append(-1.5e300);
+    params.append(0.1);
+    params.append(QString::fromUtf8("quote \" backslash \\ tab \t nl \n bell \a \xc3\xa9"));
+    params.append(QJsonValue());
+    params.append(true);
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.method", params);
+    QTest::newRow("request") << request;
+
+    QJsonObject named;
+    named.insert("b", QJsonArray());
+    named.insert("a", QJsonObject());
+    QTest::newRow("named-params") << QJsonRpcMessage::createRequest("service.method", named);
+    QTest::newRow("notification") << QJsonRpcMessage::createNotification("service.notify");
+    QTest::newRow("response") << request.createResponse(QJsonValue(QString("result")));
+    QTest::newRow("error") << request.createErrorResponse(QJsonRpc::InvalidParams,
+                                                          "invalid", QJsonValue(3));
+
+    QJsonObject other = request.toObject();
+    other.insert("jsonrpc", QLatin1String("1.0"));
+    other.insert("extra", QLatin1String("member"));
+    QTest::newRow("not-2.0-extra-members") << QJsonRpcMessage(other);
+
+    QTest::newRow("lazy") << QJsonRpcMessage::fromEnvelope(
+        "{\"method\": \"m\", \"params\": [1, {\"x\": \"y\"}], \"jsonrpc\": \"2.0\", \"id\": 3}");
+    QTest::newRow("lazy-multiline") << QJsonRpcMessage::fromEnvelope(
+        "{\"method\": \"m\", \"params\": [1,\n 2], \"jsonrpc\": \"2.0\", \"id\": 3}");
+}
+
+void TestQJsonRpcMessage::serialize()
+{
+    QFETCH(QJsonRpcMessage, message);
+
+    QByteArray out;
+    message.serialize(out);
+    QVERIFY(!out.contains('\n'));
+    if (message.toObject().value("jsonrpc").toString() == QLatin1String("2.0"))
+        QVERIFY(out.startsWith("{\"jsonrpc\":\"2.0\","));
+
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(out, &error);
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    QCOMPARE(document.object(), message.toObject());
+    QVERIFY(QJsonRpcMessage(out) == message);
+
+    // serialize appends, a reused buffer keeps what was already there
+    QByteArray reused("x");
+    message.serialize(reused);
+    QCOMPARE(reused, "x" + out);
+}
+
 QTEST_MAIN(TestQJsonRpcMessage)
 #include "tst_qjsonrpcmessage.moc"
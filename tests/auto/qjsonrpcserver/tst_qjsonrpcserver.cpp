@@ -14,9 +14,12 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
  * Lesser General Public License for more details.
  */
+#include <QLocalServer>
 #include <QLocalSocket>
 #include <QTcpSocket>
 #include <QScopedPointer>
+#include <QSemaphore>
+#include <QThreadPool>
 
 #include <QtCore/QEventLoop>
 #include <QtCore/QVariant>
@@ -30,6 +33,8 @@
 
 #include "qjsonrpcabstractserver_p.h"
 #include "qjsonrpcabstractserver.h"
+#include "qjsonrpclocalserver.h"
+#include "qjsonrpctcpserver.h"
 #include "qjsonrpcsocket.h"
 #include "qjsonrpcservice_p.h"
 #include "qjsonrpcservice.h"
@@ -183,6 +188,14 @@ private Q_SLOTS:
 
     void addRemoveService();
     void serviceWithNoGivenName();
+    void notifySubscribers();
+    void tcpWorkerThreads_data();
+    void tcpWorkerThreads();
+    void threadPoolService();
+    void deletePooledService();
+    void requestTimeout();
+    void delayedResponse();
+    void resultSignal();
 
 private:
     void clearBuffers();
@@ -844,6 +857,12 @@ void TestQJsonRpcServer::addRemoveService()
     QVERIFY(m_server->removeService(&srv));
     response = m_clientSocket->sendMessageBlocking(request);
     QVERIFY(response.errorCode() == QJsonRpc::MethodNotFound);
+
+    // routes come back with the service
+    QVERIFY(m_server->addService(&srv));
+    response = m_clientSocket->sendMessageBlocking(request);
+    QVERIFY(response.errorCode() == QJsonRpc::NoError);
+    QVERIFY(m_server->removeService(&srv));
 }
 
 class TestServiceWithoutServiceName : public QJsonRpcService
@@ -873,5 +892,373 @@ void TestQJsonRpcServer::serviceWithNoGivenName()
     QCOMPARE(spyMessageReceived.count(), 1);
 }
 
+void TestQJsonRpcServer::notifySubscribers()
+{
+    QLocalServer::removeServer("qjsonrpc-subscriptions");
+    QJsonRpcLocalServer server;
+    QVERIFY(server.listen("qjsonrpc-subscriptions"));
+
+    QLocalSocket subscribed;
+    subscribed.connectToServer("qjsonrpc-subscriptions");
+    QVERIFY(subscribed.waitForConnected());
+    QJsonRpcSocket subscribedSocket(&subscribed);
+
+    QLocalSocket other;
+    other.connectToServer("qjsonrpc-subscriptions");
+    QVERIFY(other.waitForConnected());
+    QJsonRpcSocket otherSocket(&other);
+
+    QJsonRpcMessage response = subscribedSocket.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("rpc.subscribe", QLatin1String("prices")), 5000);
+    QVERIFY(response.result().toBool());
+    response = otherSocket.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("rpc.subscribe", QLatin1String("news")), 5000);
+    QVERIFY(response.result().toBool());
+
+    // only the subscriber of the topic is notified
+    QSignalSpy spySubscribed(&subscribedSocket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    QSignalSpy spyOther(&otherSocket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    QEventLoop loop;
+    connect(&subscribedSocket, SIGNAL(messageReceived(QJsonRpcMessage)), &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    server.notifySubscribers("prices", "prices.update", QJsonArray() << 42);
+    loop.exec();
+
+    QCOMPARE(spySubscribed.count(), 1);
+    QJsonRpcMessage notification = spySubscribed.takeFirst().at(0).value<QJsonRpcMessage>();
+    QCOMPARE(notification.method(), QString("prices.update"));
+    QCOMPARE(spyOther.count(), 0);
+
+    // nothing once unsubscribed
+    response = subscribedSocket.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("rpc.unsubscribe", QLatin1String("prices")), 5000);
+    QVERIFY(response.result().toBool());
+    spySubscribed.clear();
+    server.notifySubscribers("prices", "prices.update", QJsonArray() << 43);
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(spySubscribed.count(), 0);
+
+    // topics are required
+    response = subscribedSocket.sendMessageBlocking(
+        QJsonRpcMessage::createRequest("rpc.subscribe"), 5000);
+    QCOMPARE(response.errorCode(), int(QJsonRpc::InvalidParams));
+}
+
+void TestQJsonRpcServer::tcpWorkerThreads_data()
+{
+    QTest::addColumn<int>("loadBalancing");
+    QTest::newRow("round-robin") << int(QJsonRpcTcpServer::RoundRobin);
+    QTest::newRow("least-connections") << int(QJsonRpcTcpServer::LeastConnections);
+    QTest::newRow("reuse-port") << int(QJsonRpcTcpServer::ReusePort);
+}
+
+void TestQJsonRpcServer::tcpWorkerThreads()
+{
+    QFETCH(int, loadBalancing);
+
+    QJsonRpcTcpServer server;
+    server.setWorkerThreadCount(2);
+    server.setLoadBalancing(static_cast<QJsonRpcTcpServer::LoadBalancing>(loadBalancing));
+    QVERIFY(server.addService(new TestService));
+    if (!server.listen(QHostAddress::LocalHost, 0)) {
+        // an unsupported ReusePort fails listen() and keeps the configured value
+        QCOMPARE(loadBalancing, int(QJsonRpcTcpServer::ReusePort));
+        QCOMPARE(int(server.loadBalancing()), loadBalancing);
+        QVERIFY(!server.errorString().isEmpty());
+#if QT_VERSION >= 0x050000
+        QSKIP("SO_REUSEPORT is not supported on this platform");
+#else
+        QSKIP("SO_REUSEPORT is not supported on this platform", SkipSingle);
+#endif
+    }
+
+    // port 0 lets the system pick one, serverPort() reports it
+    const quint16 port = server.serverPort();
+    QVERIFY(port != 0);
+
+    // the clients end up in different worker threads, the service stays here
+    QTcpSocket first;
+    first.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(first.waitForConnected());
+    QJsonRpcSocket firstSocket(&first);
+
+    QTcpSocket second;
+    second.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(second.waitForConnected());
+    QJsonRpcSocket secondSocket(&second);
+
+    QJsonRpcMessage request =
+        QJsonRpcMessage::createRequest("service.singleParam", QLatin1String("first"));
+    QJsonRpcMessage response = firstSocket.sendMessageBlocking(request, 5000);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.result().toString(), QLatin1String("first"));
+
+    request = QJsonRpcMessage::createRequest("service.singleParam", QLatin1String("second"));
+    response = secondSocket.sendMessageBlocking(request, 5000);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.result().toString(), QLatin1String("second"));
+
+    // notifications cross over to the worker threads too
+    QSignalSpy spy(&secondSocket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    QEventLoop loop;
+    connect(&secondSocket, SIGNAL(messageReceived(QJsonRpcMessage)), &loop, SLOT(quit()));
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    server.notifyConnectedClients("service.event", QJsonArray() << 42);
+    loop.exec();
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.takeFirst().at(0).value<QJsonRpcMessage>().method(), QString("service.event"));
+}
+
+class ConcurrentService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "concurrent")
+    Q_CLASSINFO("concurrency", "threadpool")
+public:
+    ConcurrentService(QObject *parent = 0)
+        : QJsonRpcService(parent)
+    {}
+
+public Q_SLOTS:
+    bool runsInPool() {
+        return QThread::currentThread() != qApp->thread() && senderSocket() != 0;
+    }
+
+};
+
+void TestQJsonRpcServer::threadPoolService()
+{
+    ConcurrentService *service = new ConcurrentService;
+    QVERIFY(m_server->addService(service));
+    QCOMPARE(service->threadPool(), QThreadPool::globalInstance());
+
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("concurrent.runsInPool");
+    QJsonRpcMessage response = m_clientSocket->sendMessageBlocking(request, 5000);
+    QCOMPARE(response.id(), request.id());
+    QVERIFY(response.result().toBool());
+}
+
+class SlowService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "slow")
+    Q_CLASSINFO("concurrency", "threadpool")
+public:
+    SlowService(QObject *parent = 0)
+        : QJsonRpcService(parent)
+    {
+        s_destroyed = false;
+        s_finished = 0;
+    }
+
+    ~SlowService() {
+        s_destroyed = true;
+    }
+
+    bool waitForStarted() {
+        for (int i = 0; i < 500; ++i) {
+            if (m_started.tryAcquire())
+                return true;
+            QTest::qWait(10);
+        }
+        return false;
+    }
+
+    // 1 if the slot ran to its end on an intact service, -1 if not
+    static int s_finished;
+    static bool s_destroyed;
+
+public Q_SLOTS:
+    int slow(int value) {
+        m_started.release();
+        QTest::qSleep(100);
+        s_finished = s_destroyed ? -1 : 1;
+        return value;
+    }
+
+private:
+    QSemaphore m_started;
+
+};
+
+int SlowService::s_finished = 0;
+bool SlowService::s_destroyed = false;
+
+void TestQJsonRpcServer::deletePooledService()
+{
+    // removing the service waits for the slot still running
+    SlowService *service = new SlowService;
+    QVERIFY(m_server->addService(service));
+    m_clientSocket->sendMessage(QJsonRpcMessage::createRequest("slow.slow", 1));
+    QVERIFY(service->waitForStarted());
+    QVERIFY(m_server->removeService(service));
+    delete service;
+    QCOMPARE(SlowService::s_finished, 1);
+
+    // so does deleting the server that owns it
+    service = new SlowService;
+    QVERIFY(m_server->addService(service));
+    m_clientSocket->sendMessage(QJsonRpcMessage::createRequest("slow.slow", 2));
+    QVERIFY(service->waitForStarted());
+    delete m_server.take();
+    QVERIFY(SlowService::s_destroyed);
+    QCOMPARE(SlowService::s_finished, 1);
+
+    // and the server whose child it is, before the children go
+    init();
+    service = new SlowService(m_server.data());
+    QVERIFY(m_server->addService(service));
+    m_clientSocket->sendMessage(QJsonRpcMessage::createRequest("slow.slow", 3));
+    QVERIFY(service->waitForStarted());
+    delete m_server.take();
+    QVERIFY(SlowService::s_destroyed);
+    QCOMPARE(SlowService::s_finished, 1);
+}
+
+void TestQJsonRpcServer::requestTimeout()
+{
+    // one thread, so the second request waits for the first to finish
+    QThreadPool pool;
+    pool.setMaxThreadCount(1);
+    SlowService *service = new SlowService;
+    service->setThreadPool(&pool);
+    QVERIFY(m_server->addService(service));
+    QCOMPARE(m_server->requestTimeout(), -1);
+    m_server->setRequestTimeout(50);
+    QCOMPARE(m_server->requestTimeout(), 50);
+
+    QSignalSpy spyMessageReceived(m_clientSocket.data(), SIGNAL(messageReceived(QJsonRpcMessage)));
+    QJsonRpcMessage first = QJsonRpcMessage::createRequest("slow.slow", 1);
+    QJsonRpcMessage second = QJsonRpcMessage::createRequest("slow.slow", 2);
+    m_clientSocket->sendMessage(first);
+    m_clientSocket->sendMessage(second);
+    for (int i = 0; i < 500 && spyMessageReceived.count() < 2; ++i)
+        QTest::qWait(10);
+    QCOMPARE(spyMessageReceived.count(), 2);
+
+    QHash<int, QJsonRpcMessage> responses;
+    for (int i = 0; i < spyMessageReceived.count(); ++i) {
+        QJsonRpcMessage response = spyMessageReceived.at(i).at(0).value<QJsonRpcMessage>();
+        responses.insert(response.id(), response);
+    }
+
+    QCOMPARE(responses.value(first.id()).type(), QJsonRpcMessage::Response);
+    QCOMPARE(responses.value(first.id()).result().toDouble(), 1.0);
+    QCOMPARE(responses.value(second.id()).type(), QJsonRpcMessage::Error);
+    QCOMPARE(responses.value(second.id()).errorCode(), int(QJsonRpc::TimeoutError));
+
+    QVERIFY(m_server->removeService(service));
+    delete service;
+}
+
+class DelayedResponder : public QThread
+{
+public:
+    DelayedResponder(const QJsonRpcServiceRequest &request, int value, QObject *parent = 0)
+        : QThread(parent), m_request(request), m_value(value)
+    {
+        connect(this, SIGNAL(finished()), this, SLOT(deleteLater()));
+    }
+
+protected:
+    void run() {
+        msleep(10);
+        m_request.respond(QJsonValue(m_value * 2));
+    }
+
+private:
+    QJsonRpcServiceRequest m_request;
+    int m_value;
+};
+
+class DelayedService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "delayed")
+public:
+    DelayedService(QObject *parent = 0)
+        : QJsonRpcService(parent),
+          m_value(0)
+    {}
+
+public Q_SLOTS:
+    int fromTimer(int value) {
+        m_pending = beginDelayedResponse();
+        m_value = value;
+        QTimer::singleShot(10, this, SLOT(respond()));
+        return -1;
+    }
+
+    int fromThread(int value) {
+        DelayedResponder *responder = new DelayedResponder(beginDelayedResponse(), value, this);
+        responder->start();
+        return -1;
+    }
+
+private Q_SLOTS:
+    void respond() {
+        m_pending.respond(QJsonValue(m_value * 2));
+    }
+
+private:
+    QJsonRpcServiceRequest m_pending;
+    int m_value;
+
+};
+
+void TestQJsonRpcServer::delayedResponse()
+{
+    QVERIFY(m_server->addService(new DelayedService));
+    QSignalSpy spyMessageReceived(m_clientSocket.data(), SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("delayed.fromTimer", 21);
+    QJsonRpcMessage response = m_clientSocket->sendMessageBlocking(request, 5000);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.result().toDouble(), 42.0);
+
+    request = QJsonRpcMessage::createRequest("delayed.fromThread", 4);
+    response = m_clientSocket->sendMessageBlocking(request, 5000);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.result().toDouble(), 8.0);
+
+    // the slots' return values were never sent
+    QTest::qWait(50);
+    QCOMPARE(spyMessageReceived.count(), 2);
+}
+
+class ResultSignalService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "manual")
+public:
+    ResultSignalService(QObject *parent = 0)
+        : QJsonRpcService(parent)
+    {}
+
+public Q_SLOTS:
+    int answer(int value) {
+        Q_EMIT result(currentRequest().request().createResponse(QJsonValue(value * 3)));
+        return -1;
+    }
+
+};
+
+void TestQJsonRpcServer::resultSignal()
+{
+    QVERIFY(m_server->addService(new ResultSignalService));
+    QSignalSpy spyMessageReceived(m_clientSocket.data(), SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    // emitting result() from the slot still answers the request
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("manual.answer", 5);
+    QJsonRpcMessage response = m_clientSocket->sendMessageBlocking(request, 5000);
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.result().toDouble(), 15.0);
+
+    // and the slot's return value is not sent after it
+    QTest::qWait(50);
+    QCOMPARE(spyMessageReceived.count(), 1);
+}
+
 QTEST_MAIN(TestQJsonRpcServer)
 #include "tst_qjsonrpcserver.moc"
@@ -34,6 +34,11 @@ private slots:
     void dispatch();
     void ambiguousDispatch();
     void dispatchSignals();
+    void registeredMethods();
+    void resolvedMethodCache();
+    void namedParametersOrder();
+    void integerArguments();
+    void wideArguments();
 
 };
 
@@ -67,6 +72,24 @@ public Q_SLOTS:
         return string;
     }
 
+    QString namedOrder(const QString &zeta, int alpha, bool middle) const {
+        return QString("%1 %2 %3").arg(zeta).arg(alpha).arg(middle ? "true" : "false");
+    }
+
+    int integer(int value) const { return value; }
+    uint unsignedInteger(uint value) const { return value; }
+    qlonglong longLong(qlonglong value) const { return value; }
+
+    // more arguments than fit the inline frame
+    QString wide(const QVariant &a, const QVariant &b, const QVariant &c,
+                 const QVariant &d, const QVariant &e, const QVariant &f,
+                 const QVariant &g, const QVariant &h, const QVariant &i) const
+    {
+        return (QStringList() << a.toString() << b.toString() << c.toString()
+                              << d.toString() << e.toString() << f.toString()
+                              << g.toString() << h.toString() << i.toString()).join(QString());
+    }
+
     // note: order of definition matters here for ambiguousDispatch test
     void ambiguousMethod(const QString &) {
         m_stringCount++;
@@ -87,6 +110,41 @@ private:
 
 };
 
+class RegisteredService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "registered")
+public:
+    RegisteredService(QObject *parent = 0)
+        : QJsonRpcService(parent),
+          m_resetCount(0)
+    {
+        registerMethod("add", &RegisteredService::addIntegers, QStringList() << "a" << "b");
+        registerMethod("join", &RegisteredService::join);
+        registerMethod("reset", &RegisteredService::reset);
+    }
+
+    bool testDispatch(const QJsonRpcMessage &message) {
+        return QJsonRpcService::dispatch(message);
+    }
+
+    int addIntegers(int a, int b) const { return a + b; }
+    QString join(const QStringList &list, const QString &separator) {
+        return list.join(separator);
+    }
+    void reset() { m_resetCount++; }
+
+    int resetCount() const { return m_resetCount; }
+
+public Q_SLOTS:
+    // hidden by the registered method of the same name
+    int add(const QString &, const QString &) { return -1; }
+
+private:
+    int m_resetCount;
+
+};
+
 class TestServiceProvider : public QJsonRpcServiceProvider
 {
 public:
@@ -179,5 +237,180 @@ void TestQJsonRpcService::dispatchSignals()
     QCOMPARE(service.testDispatch(invalidRequestSignalDispatch), false);
 }
 
+void TestQJsonRpcService::registeredMethods()
+{
+    TestServiceProvider provider;
+    RegisteredService service;
+    provider.addService(&service);
+    QSignalSpy spy(&service, SIGNAL(result(QJsonRpcMessage)));
+
+    QJsonArray params;
+    params.append(2);
+    params.append(3);
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("registered.add", params)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().result().toInt(), 5);
+
+    QJsonObject namedParameters;
+    namedParameters.insert("b", 10);
+    namedParameters.insert("a", 4);
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("registered.add", namedParameters)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().result().toInt(), 14);
+
+    QJsonArray joinParams;
+    joinParams.append(QJsonArray::fromStringList(QStringList() << "a" << "b" << "c"));
+    joinParams.append(QLatin1String("-"));
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("registered.join", joinParams)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().result().toString(), QLatin1String("a-b-c"));
+
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createNotification("registered.reset")));
+    QCOMPARE(service.resetCount(), 1);
+
+    // wrong types, wrong arity and names the method was not registered with
+    QJsonArray invalidParams;
+    invalidParams.append(QLatin1String("two"));
+    invalidParams.append(3);
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("registered.add", invalidParams)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().errorCode(), int(QJsonRpc::InvalidParams));
+
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("registered.add", 2)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().errorCode(), int(QJsonRpc::InvalidParams));
+
+    // numbers are rounded, those that don't fit the argument are refused
+    QJsonArray roundedParams;
+    roundedParams.append(2.6);
+    roundedParams.append(-3.2);
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("registered.add", roundedParams)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().result().toInt(), 0);
+
+    QJsonArray outOfRangeParams;
+    outOfRangeParams.append(1e20);
+    outOfRangeParams.append(3);
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("registered.add", outOfRangeParams)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().errorCode(), int(QJsonRpc::InvalidParams));
+
+    QJsonObject unknownNames;
+    unknownNames.insert("list", QJsonArray());
+    unknownNames.insert("separator", QLatin1String(","));
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("registered.join", unknownNames)));
+}
+
+void TestQJsonRpcService::resolvedMethodCache()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+
+    QJsonRpcMessage stringDispatch =
+        QJsonRpcMessage::createRequest("service.ambiguousMethod", QLatin1String("first"));
+    QVERIFY(service.testDispatch(stringDispatch));
+    QCOMPARE(service.resolvedMethodCacheMisses(), 1);
+    QCOMPARE(service.resolvedMethodCacheHits(), 0);
+
+    // same types, different values
+    stringDispatch =
+        QJsonRpcMessage::createRequest("service.ambiguousMethod", QLatin1String("second"));
+    QVERIFY(service.testDispatch(stringDispatch));
+    QCOMPARE(service.resolvedMethodCacheMisses(), 1);
+    QCOMPARE(service.resolvedMethodCacheHits(), 1);
+    QCOMPARE(service.stringCount(), 2);
+
+    QJsonRpcMessage intDispatch =
+        QJsonRpcMessage::createRequest("service.ambiguousMethod", 10);
+    QVERIFY(service.testDispatch(intDispatch));
+    QVERIFY(service.testDispatch(intDispatch));
+    QCOMPARE(service.resolvedMethodCacheMisses(), 2);
+    QCOMPARE(service.resolvedMethodCacheHits(), 2);
+    QCOMPARE(service.intCount(), 2);
+
+    // named parameters are keyed by name as well as type
+    QJsonObject namedParameters;
+    namedParameters.insert("string", QLatin1String("testParam"));
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("service.testMethod", namedParameters)));
+    QJsonObject invalidNamedParameters;
+    invalidNamedParameters.insert("testParameter", QLatin1String("testParam"));
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("service.testMethod", invalidNamedParameters)));
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("service.testMethod", invalidNamedParameters)));
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("service.testMethod", namedParameters)));
+    QCOMPARE(service.resolvedMethodCacheMisses(), 4);
+    QCOMPARE(service.resolvedMethodCacheHits(), 4);
+}
+
+void TestQJsonRpcService::namedParametersOrder()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+    QSignalSpy spy(&service, SIGNAL(result(QJsonRpcMessage)));
+
+    // parameters are declared in a different order than their names sort in,
+    // and keys the method doesn't take sit between them
+    QJsonObject namedParameters;
+    namedParameters.insert("zeta", QLatin1String("z"));
+    namedParameters.insert("extra", QLatin1String("ignored"));
+    namedParameters.insert("middle", true);
+    namedParameters.insert("alpha", 7);
+    namedParameters.insert("beta", 8);
+
+    // once resolving, once from the cache
+    for (int i = 0; i < 2; ++i) {
+        QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("service.namedOrder", namedParameters)));
+        QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().result().toString(), QLatin1String("z 7 true"));
+    }
+    QCOMPARE(service.resolvedMethodCacheHits(), 1);
+
+    namedParameters.insert("alpha", QLatin1String("seven"));
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("service.namedOrder", namedParameters)));
+
+    namedParameters.remove("alpha");
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("service.namedOrder", namedParameters)));
+}
+
+void TestQJsonRpcService::integerArguments()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+    QSignalSpy spy(&service, SIGNAL(result(QJsonRpcMessage)));
+
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("service.integer", 41.6)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().result().toInt(), 42);
+
+    QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("service.unsignedInteger", 4294967295.0)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().result().toDouble(), 4294967295.0);
+
+    // numbers that don't fit are refused rather than wrapped
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("service.integer", 1e10)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().errorCode(), int(QJsonRpc::InvalidParams));
+
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("service.unsignedInteger", -1)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().errorCode(), int(QJsonRpc::InvalidParams));
+
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("service.unsignedInteger", 4294967296.0)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().errorCode(), int(QJsonRpc::InvalidParams));
+
+    QVERIFY(!service.testDispatch(QJsonRpcMessage::createRequest("service.longLong", 1e19)));
+    QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().errorCode(), int(QJsonRpc::InvalidParams));
+}
+
+void TestQJsonRpcService::wideArguments()
+{
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+    QSignalSpy spy(&service, SIGNAL(result(QJsonRpcMessage)));
+
+    QJsonArray params;
+    for (int i = 0; i < 9; ++i)
+        params.append(QString::number(i));
+
+    // once resolving, once from the cache
+    for (int i = 0; i < 2; ++i) {
+        QVERIFY(service.testDispatch(QJsonRpcMessage::createRequest("service.wide", params)));
+        QCOMPARE(spy.last().at(0).value<QJsonRpcMessage>().result().toString(),
+                 QString("012345678"));
+    }
+    QCOMPARE(service.resolvedMethodCacheHits(), 1);
+}
+
 QTEST_MAIN(TestQJsonRpcService)
 #include "tst_qjsonrpcservice.moc"
@@ -62,6 +62,60 @@ public:
     }
 };
 
+class BatchTestService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "service")
+public:
+    BatchTestService(QObject *parent = 0) : QJsonRpcService(parent) {}
+
+public Q_SLOTS:
+    int add(int a, int b) { return a + b; }
+    int addAndNotify(int a, int b) {
+        senderSocket()->notify(QJsonRpcMessage::createNotification("service.progress"));
+        return a + b;
+    }
+};
+
+class DelayedBatchTestService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "delayed")
+public:
+    DelayedBatchTestService(QObject *parent = 0) : QJsonRpcService(parent) {}
+
+public Q_SLOTS:
+    int add(int a, int b) {
+        m_pending.append(qMakePair(beginDelayedResponse(), a + b));
+        QTimer::singleShot(20, this, SLOT(respond()));
+        return -1;
+    }
+
+private Q_SLOTS:
+    void respond() {
+        QPair<QJsonRpcServiceRequest, int> pending = m_pending.takeFirst();
+        pending.first.respond(QJsonValue(pending.second));
+    }
+
+private:
+    QList<QPair<QJsonRpcServiceRequest, int> > m_pending;
+};
+
+class PooledBatchTestService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "pooled")
+    Q_CLASSINFO("concurrency", "threadpool")
+public:
+    PooledBatchTestService(QObject *parent = 0) : QJsonRpcService(parent) {}
+
+public Q_SLOTS:
+    int add(int a, int b) {
+        QTest::qSleep(20);
+        return a + b;
+    }
+};
+
 class TestQJsonRpcSocket: public QObject
 {
     Q_OBJECT  
@@ -76,6 +130,26 @@ private Q_SLOTS:
     void notification();
     void response();
     void delayedMessageReceive();
+    void incrementalFraming();
+    void pipelinedMessages();
+    void framing_data();
+    void framing();
+    void invalidFrameHeaders();
+    void scannerImplementations_data();
+    void scannerImplementations();
+    void binaryEncoding();
+    void binaryAfterText();
+    void batchRequest();
+    void emptyBatch();
+    void batchWithNotification();
+    void batchWithDelayedResponses_data();
+    void batchWithDelayedResponses();
+    void lazyParsing();
+    void sendMessages();
+    void sendMessagesDuplicateIds();
+    void writeCoalescing();
+    void writeCoalescingThreshold();
+    void waterMarks();
 
 private:
     // benchmark parsing speed
@@ -247,5 +321,612 @@ void TestQJsonRpcSocket::delayedMessageReceive()
         qApp->processEvents();
 }
 
+void TestQJsonRpcSocket::incrementalFraming()
+{
+    QByteArray message =
+        "  {\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"test.framing\"," \
+        "\"params\": [\"}{\\\\\", \"\\\"]\", [1, {\"a\": 2}]]}";
+
+    for (int chunkSize = 1; chunkSize < message.size(); ++chunkSize) {
+        QJsonRpcSocketPrivate socketPrivate;
+        QByteArray received;
+        int pos = -1;
+        for (int i = 0; i < message.size(); i += chunkSize) {
+            received.append(message.mid(i, chunkSize));
+            pos = socketPrivate.findJsonDocumentEnd(received);
+            if (received.size() < message.size())
+                QCOMPARE(pos, -1);
+        }
+
+        QCOMPARE(pos, message.size() - 1);
+    }
+}
+
+void TestQJsonRpcSocket::pipelinedMessages()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket serviceSocket(&buffer, this);
+    QSignalSpy spyMessageReceived(&serviceSocket,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    // several messages landing in a single read
+    buffer.write("{\"jsonrpc\": \"2.0\", \"id\": 1, \"result\": 1}\n"
+                 "{\"jsonrpc\": \"2.0\", \"id\": 2, \"result\": \"}\"}"
+                 "{\"jsonrpc\": \"2.0\", \"id\": 3, \"result\": [3]}");
+    buffer.seek(0);
+    while (spyMessageReceived.size() < 3)
+        qApp->processEvents();
+
+    QCOMPARE(spyMessageReceived.count(), 3);
+    for (int i = 0; i < spyMessageReceived.size(); ++i) {
+        QJsonRpcMessage message =
+            spyMessageReceived.at(i).at(0).value<QJsonRpcMessage>();
+        QCOMPARE(message.type(), QJsonRpcMessage::Response);
+        QCOMPARE(message.id(), i + 1);
+    }
+}
+
+void TestQJsonRpcSocket::framing_data()
+{
+    QTest::addColumn<int>("framing");
+    QTest::addColumn<QByteArray>("header");
+
+    QTest::newRow("stream") << int(QJsonRpc::StreamFraming) << QByteArray("{");
+    QTest::newRow("content-length") << int(QJsonRpc::ContentLengthFraming)
+                                    << QByteArray("Content-Length: ");
+    QTest::newRow("length-prefix") << int(QJsonRpc::LengthPrefixFraming)
+                                   << QByteArray("\0\0\0", 3);
+    QTest::newRow("newline") << int(QJsonRpc::NewlineFraming) << QByteArray("{");
+}
+
+void TestQJsonRpcSocket::framing()
+{
+    QFETCH(int, framing);
+    QFETCH(QByteArray, header);
+
+    QBuffer outgoing;
+    outgoing.open(QIODevice::ReadWrite);
+    QJsonRpcSocket sender(&outgoing, this);
+    sender.setFraming(static_cast<QJsonRpc::Framing>(framing));
+    QCOMPARE(int(sender.framing()), framing);
+
+    QJsonRpcMessage first =
+        QJsonRpcMessage::createNotification("test.first", QString("{\"}"));
+    QJsonRpcMessage second =
+        QJsonRpcMessage::createNotification("test.second", 2);
+    sender.notify(first);
+    sender.notify(second);
+
+    const QByteArray data = outgoing.data();
+    QVERIFY(data.startsWith(header));
+    if (framing == QJsonRpc::NewlineFraming) {
+        QCOMPARE(data.count('\n'), 2);
+        QVERIFY(data.endsWith('\n'));
+    }
+
+    QBuffer incoming;
+    incoming.open(QIODevice::ReadWrite);
+    QJsonRpcSocket receiver(&incoming, this);
+    receiver.setFraming(static_cast<QJsonRpc::Framing>(framing));
+    QSignalSpy spyMessageReceived(&receiver,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    // deliver the frames one byte at a time
+    for (int i = 0; i < data.size(); ++i) {
+        incoming.write(data.constData() + i, 1);
+        incoming.seek(incoming.pos() - 1);
+        qApp->processEvents();
+    }
+
+    while (spyMessageReceived.size() < 2)
+        qApp->processEvents();
+
+    QCOMPARE(spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>(), first);
+    QCOMPARE(spyMessageReceived.at(1).at(0).value<QJsonRpcMessage>(), second);
+}
+
+void TestQJsonRpcSocket::invalidFrameHeaders()
+{
+    QBuffer incoming;
+    incoming.open(QIODevice::ReadWrite);
+    QJsonRpcSocket receiver(&incoming, this);
+    receiver.setFraming(QJsonRpc::ContentLengthFraming);
+    QSignalSpy spyMessageReceived(&receiver,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    // any number of headers without a Content-Length are skipped in turn
+    QByteArray message;
+    QJsonRpcMessage::createNotification("test.valid", 1).serialize(message);
+    QByteArray data;
+    for (int i = 0; i < 100000; ++i)
+        data.append("X-Invalid: 1\r\n\r\n");
+    data.append("Content-Length: " + QByteArray::number(message.size()) + "\r\n\r\n");
+    data.append(message);
+    incoming.write(data);
+    incoming.seek(0);
+    while (spyMessageReceived.size() < 1)
+        qApp->processEvents();
+    QCOMPARE(spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>().method(),
+             QString("test.valid"));
+
+    // a header that never ends closes the connection
+    const qint64 end = incoming.size();
+    incoming.seek(end);
+    incoming.write(QByteArray(16 * 1024, 'x'));
+    incoming.seek(end);
+    for (int i = 0; i < 100 && incoming.isOpen(); ++i)
+        qApp->processEvents();
+    QVERIFY(!incoming.isOpen());
+}
+
+void TestQJsonRpcSocket::scannerImplementations_data()
+{
+    QTest::addColumn<QByteArray>("document");
+
+    QTest::newRow("nested") << QByteArray("{\"a\":[1,{\"b\":[2,3]}],\"c\":{}}");
+    QTest::newRow("array") << QByteArray("[{\"a\":\"]\"},\"\\\\\",[]]");
+    QTest::newRow("escaped-quote") << QByteArray("{\"a\":\"x\\\"}y\"}");
+    QTest::newRow("escaped-backslash") << QByteArray("{\"a\":\"x\\\\\",\"b\":\"}\"}");
+    QTest::newRow("brackets-in-string") << QByteArray("{\"a\":\"{[]}}]\"}");
+    QTest::newRow("escape-runs")
+        << "{\"a\":\"" + QByteArray("\\\\\\\"").repeated(40) + "\",\"b\":[\"\\\\\"]}";
+    QTest::newRow("long-string")
+        << "{\"a\":\"" + QByteArray("}]\\\"").repeated(50) + "\"}";
+}
+
+void TestQJsonRpcSocket::scannerImplementations()
+{
+    QFETCH(QByteArray, document);
+
+    const QJsonRpcSocketPrivate::ScannerImplementation original =
+        QJsonRpcSocketPrivate::scannerImplementation();
+    const QJsonRpcSocketPrivate::ScannerImplementation implementations[] = {
+        QJsonRpcSocketPrivate::ScalarScanner,
+        QJsonRpcSocketPrivate::Sse2Scanner,
+        QJsonRpcSocketPrivate::Avx2Scanner
+    };
+
+    // every escape and quote lands on each side of a 16 and 32 byte block
+    // boundary for some padding, scanned whole and in small pieces
+    for (uint i = 0; i < sizeof(implementations) / sizeof(implementations[0]); ++i) {
+        if (!QJsonRpcSocketPrivate::setScannerImplementation(implementations[i]))
+            continue;
+
+        for (int padding = 0; padding <= 64; ++padding) {
+            const QByteArray input =
+                QByteArray(padding, ' ') + document + QByteArray(40, ' ') + "{\"next\":1}";
+            const int expected = padding + document.size() - 1;
+
+            QJsonRpcSocketPrivate whole;
+            QCOMPARE(whole.findJsonDocumentEnd(input), expected);
+
+            QJsonRpcSocketPrivate pieces;
+            int end = -1;
+            for (int length = 7; end == -1 && length < input.size() + 7; length += 7)
+                end = pieces.findJsonDocumentEnd(input.left(length));
+            QCOMPARE(end, expected);
+        }
+    }
+
+    QJsonRpcSocketPrivate::setScannerImplementation(original);
+}
+
+void TestQJsonRpcSocket::binaryEncoding()
+{
+#ifndef QJSONRPC_HAVE_BINARY_JSON
+    // falls back to text rather than use the deprecated binary format
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket socket(&buffer, this);
+    socket.setEncoding(QJsonRpc::BinaryEncoding);
+    QCOMPARE(socket.encoding(), QJsonRpc::TextEncoding);
+    socket.notify(QJsonRpcMessage::createNotification("test.text"));
+    QVERIFY(!buffer.data().startsWith("qbjs"));
+#else
+    QBuffer outgoing;
+    outgoing.open(QIODevice::ReadWrite);
+    QJsonRpcSocket sender(&outgoing, this);
+    sender.setEncoding(QJsonRpc::BinaryEncoding);
+
+    QJsonRpcMessage binary =
+        QJsonRpcMessage::createNotification("test.binary", QString("{\"}"));
+    sender.notify(binary);
+    QVERIFY(outgoing.data().startsWith("qbjs"));
+
+    // binary and text messages can be mixed on the same stream
+    QJsonRpcMessage text = QJsonRpcMessage::createNotification("test.text", 2);
+    sender.setEncoding(QJsonRpc::TextEncoding);
+    sender.notify(text);
+    const QByteArray data = outgoing.data();
+
+    // only a receiver told to match its peer answers binary once it got some
+    const QJsonRpc::Encoding encodings[] = { QJsonRpc::TextEncoding, QJsonRpc::MatchPeerEncoding };
+    for (int e = 0; e < 2; ++e) {
+        QBuffer incoming;
+        incoming.open(QIODevice::ReadWrite);
+        QJsonRpcSocket receiver(&incoming, this);
+        receiver.setEncoding(encodings[e]);
+        QSignalSpy spyMessageReceived(&receiver,
+                                      SIGNAL(messageReceived(QJsonRpcMessage)));
+
+        for (int i = 0; i < data.size(); ++i) {
+            incoming.write(data.constData() + i, 1);
+            incoming.seek(incoming.pos() - 1);
+            qApp->processEvents();
+        }
+
+        while (spyMessageReceived.size() < 2)
+            qApp->processEvents();
+
+        QCOMPARE(spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>(), binary);
+        QCOMPARE(spyMessageReceived.at(1).at(0).value<QJsonRpcMessage>(), text);
+
+        // the setting itself stays as it was given
+        QCOMPARE(receiver.encoding(), encodings[e]);
+        incoming.seek(incoming.size());
+        receiver.notify(QJsonRpcMessage::createNotification("test.answer"));
+        QCOMPARE(incoming.data().mid(data.size()).startsWith("qbjs"),
+                 encodings[e] == QJsonRpc::MatchPeerEncoding);
+    }
+#endif
+}
+
+void TestQJsonRpcSocket::binaryAfterText()
+{
+#ifndef QJSONRPC_HAVE_BINARY_JSON
+    QSKIP("binary documents need a Qt version before 5.15");
+#else
+    // an indented text document ends in a newline, the binary one follows it
+    QJsonRpcMessage text = QJsonRpcMessage::createNotification("test.text", 1);
+    QJsonRpcMessage binary = QJsonRpcMessage::createNotification("test.binary", 2);
+    QByteArray data = QJsonDocument(text.toObject()).toJson();
+    data += "\r\n";
+    data += QJsonDocument(binary.toObject()).toBinaryData();
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket receiver(&buffer, this);
+    QSignalSpy spyMessageReceived(&receiver,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+    buffer.write(data);
+    buffer.seek(0);
+    while (spyMessageReceived.size() < 2)
+        qApp->processEvents();
+
+    QCOMPARE(spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>(), text);
+    QCOMPARE(spyMessageReceived.at(1).at(0).value<QJsonRpcMessage>(), binary);
+#endif
+}
+
+void TestQJsonRpcSocket::batchRequest()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcServiceSocket serviceSocket(&buffer, this);
+    serviceSocket.addService(new BatchTestService);
+    QSignalSpy spyMessageReceived(&serviceSocket,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    const QByteArray batch =
+        "[{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"service.add\", \"params\": [1, 2]},"
+        " {\"jsonrpc\": \"2.0\", \"method\": \"service.add\", \"params\": [3, 4]},"
+        " 1,"
+        " {\"jsonrpc\": \"2.0\", \"id\": 2, \"method\": \"service.missing\"}]";
+    buffer.write(batch);
+    buffer.seek(0);
+    while (spyMessageReceived.size() < 4)
+        qApp->processEvents();
+
+    // all responses are written at once, as a single array
+    QJsonDocument document = QJsonDocument::fromJson(buffer.data().mid(batch.size()));
+    QVERIFY(document.isArray());
+    QJsonArray responses = document.array();
+    QCOMPARE(responses.size(), 3);
+
+    QJsonRpcMessage response(responses.at(0).toObject());
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.id(), 1);
+    QCOMPARE(response.result().toDouble(), 3.0);
+
+    QJsonRpcMessage invalid(responses.at(1).toObject());
+    QCOMPARE(invalid.type(), QJsonRpcMessage::Error);
+    QCOMPARE(invalid.errorCode(), int(QJsonRpc::InvalidRequest));
+
+    QJsonRpcMessage notFound(responses.at(2).toObject());
+    QCOMPARE(notFound.type(), QJsonRpcMessage::Error);
+    QCOMPARE(notFound.id(), 2);
+    QCOMPARE(notFound.errorCode(), int(QJsonRpc::MethodNotFound));
+}
+
+void TestQJsonRpcSocket::emptyBatch()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcServiceSocket serviceSocket(&buffer, this);
+    QSignalSpy spyMessageReceived(&serviceSocket,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    const QByteArray batch = "[]";
+    buffer.write(batch);
+    buffer.seek(0);
+    while (spyMessageReceived.size() < 1)
+        qApp->processEvents();
+
+    // answered with a single error, not an array
+    QJsonDocument document = QJsonDocument::fromJson(buffer.data().mid(batch.size()));
+    QVERIFY(document.isObject());
+    QJsonRpcMessage error(document.object());
+    QCOMPARE(error.type(), QJsonRpcMessage::Error);
+    QCOMPARE(error.errorCode(), int(QJsonRpc::InvalidRequest));
+}
+
+void TestQJsonRpcSocket::batchWithNotification()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcServiceSocket serviceSocket(&buffer, this);
+    serviceSocket.addService(new BatchTestService);
+    QSignalSpy spyMessageReceived(&serviceSocket,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    const QByteArray batch =
+        "[{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"service.addAndNotify\", \"params\": [1, 2]}]";
+    buffer.write(batch);
+    buffer.seek(0);
+    while (spyMessageReceived.size() < 1)
+        qApp->processEvents();
+
+    // the notification sent while processing is not part of the batch's answer
+    const QByteArray written = buffer.data().mid(batch.size());
+    const int arrayStart = written.indexOf('[');
+    QVERIFY(arrayStart > 0);
+
+    QJsonDocument notification = QJsonDocument::fromJson(written.left(arrayStart));
+    QVERIFY(notification.isObject());
+    QCOMPARE(QJsonRpcMessage(notification.object()).type(), QJsonRpcMessage::Notification);
+
+    QJsonDocument responses = QJsonDocument::fromJson(written.mid(arrayStart));
+    QVERIFY(responses.isArray());
+    QCOMPARE(responses.array().size(), 1);
+    QJsonRpcMessage response(responses.array().at(0).toObject());
+    QCOMPARE(response.type(), QJsonRpcMessage::Response);
+    QCOMPARE(response.id(), 1);
+}
+
+void TestQJsonRpcSocket::batchWithDelayedResponses_data()
+{
+    QTest::addColumn<QString>("service");
+    QTest::newRow("delayed") << QString("delayed");
+    QTest::newRow("threadpool") << QString("pooled");
+}
+
+void TestQJsonRpcSocket::batchWithDelayedResponses()
+{
+    QFETCH(QString, service);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcServiceSocket serviceSocket(&buffer, this);
+    serviceSocket.addService(new BatchTestService);
+    serviceSocket.addService(new DelayedBatchTestService);
+    serviceSocket.addService(new PooledBatchTestService);
+    QSignalSpy spyMessageReceived(&serviceSocket,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    const QByteArray batch = QString(
+        "[{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"%1.add\", \"params\": [1, 2]},"
+        " {\"jsonrpc\": \"2.0\", \"id\": 2, \"method\": \"service.add\", \"params\": [3, 4]},"
+        " {\"jsonrpc\": \"2.0\", \"method\": \"service.add\", \"params\": [5, 6]},"
+        " {\"jsonrpc\": \"2.0\", \"id\": 3, \"method\": \"%1.add\", \"params\": [7, 8]}]")
+        .arg(service).toLatin1();
+    buffer.write(batch);
+    buffer.seek(0);
+    while (spyMessageReceived.size() < 4)
+        qApp->processEvents();
+
+    // the synchronous answer waits for the others
+    QCOMPARE(buffer.data().size(), batch.size());
+
+    QElapsedTimer timer;
+    timer.start();
+    QJsonDocument document;
+    while (document.isNull() && timer.elapsed() < 5000) {
+        qApp->processEvents();
+        document = QJsonDocument::fromJson(buffer.data().mid(batch.size()));
+    }
+
+    // all answers in a single array, whatever order they came in
+    QVERIFY(document.isArray());
+    QJsonArray responses = document.array();
+    QCOMPARE(responses.size(), 3);
+
+    QMap<int, double> results;
+    for (int i = 0; i < responses.size(); ++i) {
+        QJsonRpcMessage response(responses.at(i).toObject());
+        QCOMPARE(response.type(), QJsonRpcMessage::Response);
+        results.insert(response.id(), response.result().toDouble());
+    }
+
+    QCOMPARE(results.value(1), 3.0);
+    QCOMPARE(results.value(2), 7.0);
+    QCOMPARE(results.value(3), 15.0);
+}
+
+void TestQJsonRpcSocket::lazyParsing()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcServiceSocket serviceSocket(&buffer, this);
+    serviceSocket.setFraming(QJsonRpc::NewlineFraming);
+    serviceSocket.setLazyParsingEnabled(true);
+    serviceSocket.addService(new BatchTestService);
+    QSignalSpy spyMessageReceived(&serviceSocket,
+                                  SIGNAL(messageReceived(QJsonRpcMessage)));
+
+    // the second request's params aren't json, it is dropped like it would
+    // be by a full parse rather than called with no arguments
+    const QByteArray requests =
+        "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"service.add\",\"params\":[1,2]}\n"
+        "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"service.add\",\"params\":[1,2}}\n"
+        "{\"jsonrpc\":\"2.0\",\"id\":3,\"method\":\"service.add\",\"params\":{\"b\":4,\"a\":3}}\n";
+    buffer.write(requests);
+    buffer.seek(0);
+    while (spyMessageReceived.size() < 2)
+        qApp->processEvents();
+
+    QCOMPARE(spyMessageReceived.size(), 2);
+    QCOMPARE(spyMessageReceived.at(0).at(0).value<QJsonRpcMessage>().id(), 1);
+    QCOMPARE(spyMessageReceived.at(1).at(0).value<QJsonRpcMessage>().id(), 3);
+
+    const QList<QByteArray> written = buffer.data().mid(requests.size()).split('\n');
+    QCOMPARE(written.size(), 3);
+    QVERIFY(written.at(2).isEmpty());
+
+    QJsonRpcMessage first(written.at(0));
+    QCOMPARE(first.type(), QJsonRpcMessage::Response);
+    QCOMPARE(first.id(), 1);
+    QCOMPARE(first.result().toDouble(), 3.0);
+
+    QJsonRpcMessage named(written.at(1));
+    QCOMPARE(named.type(), QJsonRpcMessage::Response);
+    QCOMPARE(named.id(), 3);
+    QCOMPARE(named.result().toDouble(), 7.0);
+}
+
+void TestQJsonRpcSocket::sendMessages()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket socket(&buffer, this);
+
+    QList<QJsonRpcMessage> messages;
+    messages << QJsonRpcMessage::createRequest("test.first", 1)
+             << QJsonRpcMessage::createNotification("test.notification")
+             << QJsonRpcMessage::createRequest("test.second", 2);
+
+    QList<QJsonRpcServiceReply*> replies = socket.sendMessages(messages);
+    QCOMPARE(replies.size(), 2);
+
+    // a single compact array containing all the messages
+    QVERIFY(!buffer.data().contains('\n'));
+    QJsonDocument document = QJsonDocument::fromJson(buffer.data());
+    QVERIFY(document.isArray());
+    QCOMPARE(document.array().size(), 3);
+    for (int i = 0; i < messages.size(); ++i)
+        QCOMPARE(QJsonRpcMessage(document.array().at(i).toObject()), messages.at(i));
+
+    // answer out of order, in a single array as well
+    QJsonArray responses;
+    responses.append(messages.at(2).createResponse(QString("second")).toObject());
+    responses.append(messages.at(0).createResponse(QString("first")).toObject());
+    QSignalSpy spyFirst(replies.at(0), SIGNAL(finished()));
+    QSignalSpy spySecond(replies.at(1), SIGNAL(finished()));
+
+    const qint64 pos = buffer.pos();
+    buffer.write(QJsonDocument(responses).toJson());
+    buffer.seek(pos);
+    while (spyFirst.size() < 1 || spySecond.size() < 1)
+        qApp->processEvents();
+
+    QCOMPARE(replies.at(0)->response().result().toString(), QString("first"));
+    QCOMPARE(replies.at(1)->response().result().toString(), QString("second"));
+    qDeleteAll(replies);
+}
+
+void TestQJsonRpcSocket::sendMessagesDuplicateIds()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket socket(&buffer, this);
+
+    // the second reply could never be told apart from the first
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest("test.duplicate");
+    QList<QJsonRpcMessage> messages;
+    messages << request << request;
+    QVERIFY(socket.sendMessages(messages).isEmpty());
+    QVERIFY(buffer.data().isEmpty());
+}
+
+void TestQJsonRpcSocket::writeCoalescing()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket socket(&buffer, this);
+    socket.setWriteCoalescingEnabled(true);
+    QVERIFY(socket.isWriteCoalescingEnabled());
+
+    for (int i = 0; i < 10; ++i)
+        socket.notify(QJsonRpcMessage::createNotification("test.coalesced", i));
+
+    // nothing is written until control returns to the event loop
+    QVERIFY(buffer.data().isEmpty());
+    QCOMPARE(socket.flushCount(), qint64(0));
+
+    qApp->processEvents();
+    QCOMPARE(socket.flushCount(), qint64(1));
+    QCOMPARE(socket.flushedBytes(), qint64(buffer.data().size()));
+    QCOMPARE(buffer.data().count("test.coalesced"), 10);
+}
+
+void TestQJsonRpcSocket::writeCoalescingThreshold()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket socket(&buffer, this);
+    socket.setWriteCoalescingEnabled(true);
+    socket.setWriteCoalescingThreshold(1);
+
+    // every message crosses the threshold on its own
+    socket.notify(QJsonRpcMessage::createNotification("test.first"));
+    QCOMPARE(socket.flushCount(), qint64(1));
+    socket.notify(QJsonRpcMessage::createNotification("test.second"));
+    QCOMPARE(socket.flushCount(), qint64(2));
+    QCOMPARE(socket.flushedBytes(), qint64(buffer.data().size()));
+
+    // nothing left for the scheduled flush
+    qApp->processEvents();
+    QCOMPARE(socket.flushCount(), qint64(2));
+}
+
+void TestQJsonRpcSocket::waterMarks()
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QJsonRpcSocket socket(&buffer, this);
+    QSignalSpy spyMessageReceived(&socket, SIGNAL(messageReceived(QJsonRpcMessage)));
+    QSignalSpy spyHigh(&socket, SIGNAL(highWaterMarkReached()));
+    QSignalSpy spyLow(&socket, SIGNAL(lowWaterMarkReached()));
+
+    // keep the output pending until the next event loop pass
+    socket.setWriteCoalescingEnabled(true);
+    socket.setHighWaterMark(256);
+    socket.setLowWaterMark(64);
+
+    for (int i = 0; i < 20 && !socket.isCongested(); ++i)
+        socket.notify(QJsonRpcMessage::createNotification("test.backpressure", i));
+    QVERIFY(socket.isCongested());
+    QCOMPARE(spyHigh.count(), 1);
+    QCOMPARE(spyLow.count(), 0);
+
+    // the device reports the flushed data as written on the next event loop pass
+    socket.flush();
+    QVERIFY(socket.isCongested());
+
+    // incoming data is left alone while congested
+    const qint64 pos = buffer.pos();
+    buffer.write("{\"jsonrpc\": \"2.0\", \"id\": 1, \"result\": 1}");
+    buffer.seek(pos);
+    QMetaObject::invokeMethod(&socket, "_q_processIncomingData", Qt::DirectConnection);
+    QCOMPARE(spyMessageReceived.count(), 0);
+
+    // and picked up once drained
+    while (spyMessageReceived.size() < 1)
+        qApp->processEvents();
+    QVERIFY(!socket.isCongested());
+    QCOMPARE(spyLow.count(), 1);
+    QCOMPARE(spyHigh.count(), 1);
+}
+
 QTEST_MAIN(TestQJsonRpcSocket)
 #include "tst_qjsonrpcsocket.moc"
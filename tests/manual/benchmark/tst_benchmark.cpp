@@ -15,6 +15,7 @@
  * Lesser General Public License for more details.
  */
 #include <QScopedPointer>
+#include <QTcpSocket>
 
 #include <QtCore/QEventLoop>
 #include <QtCore/QVariant>
@@ -30,11 +31,45 @@
 
 #include "qjsonrpcabstractserver_p.h"
 #include "qjsonrpcabstractserver.h"
+#include "qjsonrpcsocket_p.h"
 #include "qjsonrpcsocket.h"
+#include "qjsonrpctcpserver.h"
 #include "qjsonrpcservice_p.h"
 #include "qjsonrpcservice.h"
 #include "qjsonrpcmessage.h"
 
+#if defined(__GLIBC__)
+/*
+ * Counts heap allocations of the whole process. Qt's containers call malloc
+ * directly, so wrapping operator new would miss most of them.
+ */
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static QAtomicInt allocationCount;
+
+extern "C" void *malloc(size_t size)
+{
+    allocationCount.ref();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    allocationCount.ref();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    allocationCount.ref();
+    return __libc_realloc(ptr, size);
+}
+
+#define QJSONRPC_COUNT_ALLOCATIONS
+#endif
+
 class TestBenchmark: public QObject
 {
     Q_OBJECT
@@ -45,6 +80,26 @@ private Q_SLOTS:
 
     void simpleCall();
     void namedParamsCall();
+    void framingLargeMessage_data();
+    void framingLargeMessage();
+    void structuralScan_data();
+    void structuralScan();
+    void parseAndDispatch_data();
+    void parseAndDispatch();
+    void broadcast_data();
+    void broadcast();
+    void tcpWorkerThreads_data();
+    void tcpWorkerThreads();
+    void requestContext_data();
+    void requestContext();
+    void typedMethod_data();
+    void typedMethod();
+    void dispatchAllocations_data();
+    void dispatchAllocations();
+    void envelopeParsing_data();
+    void envelopeParsing();
+    void serialization_data();
+    void serialization();
 
 private:
     QThread::Priority m_prio;
@@ -74,12 +129,25 @@ public Q_SLOTS:
 
         return string;
     }
+
+    // more arguments than fit the inline frame
+    int wideParams(const QVariant &a, const QVariant &b, const QVariant &c,
+                   const QVariant &d, const QVariant &e, const QVariant &f,
+                   const QVariant &g, const QVariant &h, const QVariant &i)
+    {
+        return a.toInt() + b.toInt() + c.toInt() + d.toInt() + e.toInt() +
+               f.toInt() + g.toInt() + h.toInt() + i.toInt();
+    }
 };
 
 class TestServiceProvider : public QJsonRpcServiceProvider
 {
 public:
     TestServiceProvider() {}
+
+    void process(QJsonRpcSocket *socket, const QJsonRpcMessage &message) {
+        processMessage(socket, message);
+    }
 };
 
 void TestBenchmark::initTestCase()
@@ -154,6 +222,551 @@ void TestBenchmark::namedParamsCall()
     qDebug() << elapsed;
 }
 
+static QByteArray largeMessage(int size)
+{
+    QByteArray message("{\"jsonrpc\": \"2.0\", \"id\": 1, \"result\": [");
+    const QByteArray item("{\"key\": \"some \\\"quoted\\\" data\", \"list\": [1, 2, 3]},");
+    while (message.size() + item.size() < size)
+        message.append(item);
+    message.append("{}]}");
+    return message;
+}
+
+void TestBenchmark::framingLargeMessage_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("512KB") << 512 * 1024;
+    QTest::newRow("1MB") << 1024 * 1024;
+    QTest::newRow("2MB") << 2 * 1024 * 1024;
+    QTest::newRow("5MB") << 5 * 1024 * 1024;
+}
+
+/*
+ * Simulates a large message arriving in 64KB reads, scanning after each
+ * read like _q_processIncomingData does. Time should grow linearly with
+ * the message size.
+ */
+void TestBenchmark::framingLargeMessage()
+{
+    QFETCH(int, size);
+    const int chunkSize = 64 * 1024;
+    const QByteArray message = largeMessage(size);
+
+    QByteArray received;
+    received.reserve(message.size());
+    int pos = -1;
+    QBENCHMARK {
+        QJsonRpcSocketPrivate socketPrivate;
+        received.resize(0);
+        for (int i = 0; i < message.size(); i += chunkSize) {
+            received.append(message.constData() + i, qMin(chunkSize, message.size() - i));
+            pos = socketPrivate.findJsonDocumentEnd(received);
+        }
+    }
+
+    QCOMPARE(pos, message.size() - 1);
+}
+
+static QByteArray stringHeavyMessage()
+{
+    QByteArray message("{\"jsonrpc\": \"2.0\", \"id\": 1, \"result\": [");
+    while (message.size() < 4 * 1024 * 1024)
+        message.append("\"lorem ipsum dolor sit amet, consectetur adipiscing elit\", ");
+    message.append("\"\"]}");
+    return message;
+}
+
+static QByteArray deeplyNestedMessage()
+{
+    const int depth = 100000;
+    QByteArray message("{\"jsonrpc\": \"2.0\", \"id\": 1, \"result\": ");
+    for (int i = 0; i < depth; ++i)
+        message.append("[{\"a\": ");
+    message.append("1");
+    for (int i = 0; i < depth; ++i)
+        message.append("}]");
+    message.append("}");
+    return message;
+}
+
+Q_DECLARE_METATYPE(QJsonRpcSocketPrivate::ScannerImplementation)
+void TestBenchmark::structuralScan_data()
+{
+    QTest::addColumn<QByteArray>("message");
+    QTest::addColumn<QJsonRpcSocketPrivate::ScannerImplementation>("implementation");
+
+    const QByteArray strings = stringHeavyMessage();
+    const QByteArray nested = deeplyNestedMessage();
+    QTest::newRow("strings-scalar") << strings << QJsonRpcSocketPrivate::ScalarScanner;
+    QTest::newRow("strings-sse2") << strings << QJsonRpcSocketPrivate::Sse2Scanner;
+    QTest::newRow("strings-avx2") << strings << QJsonRpcSocketPrivate::Avx2Scanner;
+    QTest::newRow("nested-scalar") << nested << QJsonRpcSocketPrivate::ScalarScanner;
+    QTest::newRow("nested-sse2") << nested << QJsonRpcSocketPrivate::Sse2Scanner;
+    QTest::newRow("nested-avx2") << nested << QJsonRpcSocketPrivate::Avx2Scanner;
+}
+
+void TestBenchmark::structuralScan()
+{
+    QFETCH(QByteArray, message);
+    QFETCH(QJsonRpcSocketPrivate::ScannerImplementation, implementation);
+
+    const QJsonRpcSocketPrivate::ScannerImplementation previous =
+        QJsonRpcSocketPrivate::scannerImplementation();
+    if (!QJsonRpcSocketPrivate::setScannerImplementation(implementation)) {
+#if QT_VERSION >= 0x050000
+        QSKIP("scanner not supported on this cpu");
+#else
+        QSKIP("scanner not supported on this cpu", SkipSingle);
+#endif
+    }
+
+    int pos = -1;
+    QBENCHMARK {
+        QJsonRpcSocketPrivate socketPrivate;
+        pos = socketPrivate.findJsonDocumentEnd(message);
+    }
+
+    QJsonRpcSocketPrivate::setScannerImplementation(previous);
+    QCOMPARE(pos, message.size() - 1);
+}
+
+void TestBenchmark::parseAndDispatch_data()
+{
+    QTest::addColumn<QByteArray>("data");
+
+    QJsonObject obj;
+    obj["integer"] = 1;
+    obj["string"] = QLatin1String("str");
+    obj["doub"] = 1.2;
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest(
+                "service.namedParams", obj);
+
+    QJsonDocument doc(request.toObject());
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+    QTest::newRow("compact") << doc.toJson(QJsonDocument::Compact);
+#else
+    QTest::newRow("text") << doc.toJson();
+#endif
+#ifdef QJSONRPC_HAVE_BINARY_JSON
+    QTest::newRow("binary") << doc.toBinaryData();
+#endif
+}
+
+/*
+ * What _q_processIncomingData does for every received frame: turn it into a
+ * document (text parsing vs. a copy of the binary representation), then
+ * dispatch it.
+ */
+void TestBenchmark::parseAndDispatch()
+{
+    QFETCH(QByteArray, data);
+
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+
+    const bool binary = QJsonRpcSocketPrivate::isBinaryDocument(data.constData(), data.size());
+    QBENCHMARK {
+#ifdef QJSONRPC_HAVE_BINARY_JSON
+        QJsonDocument document = binary ?
+            QJsonDocument::fromBinaryData(QByteArray(data.constData(), data.size())) :
+            QJsonDocument::fromJson(QByteArray::fromRawData(data.constData(), data.size()));
+#else
+        Q_UNUSED(binary)
+        QJsonDocument document =
+            QJsonDocument::fromJson(QByteArray::fromRawData(data.constData(), data.size()));
+#endif
+        QVERIFY(service.testDispatch(QJsonRpcMessage(document.object())));
+    }
+}
+
+// discards everything written to it
+class NullDevice : public QIODevice
+{
+public:
+    NullDevice(QObject *parent = 0) : QIODevice(parent) { open(QIODevice::ReadWrite); }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) { Q_UNUSED(data) Q_UNUSED(maxSize) return 0; }
+    qint64 writeData(const char *data, qint64 maxSize) { Q_UNUSED(data) return maxSize; }
+};
+
+class BroadcastServerPrivate : public QJsonRpcAbstractServerPrivate
+{
+public:
+    virtual void _q_processIncomingConnection() {}
+    virtual void _q_clientDisconnected() {}
+};
+
+class BroadcastServer : public QJsonRpcAbstractServer
+{
+public:
+    BroadcastServer(QObject *parent = 0)
+        : QJsonRpcAbstractServer(*new BroadcastServerPrivate, parent)
+    {}
+
+    virtual QString errorString() const { return QString(); }
+
+    void addClients(int count) {
+        Q_D(QJsonRpcAbstractServer);
+        for (int i = 0; i < count; ++i)
+            d->clients.append(new QJsonRpcSocket(new NullDevice(this), this));
+    }
+
+    // what notifyConnectedClients used to do
+    void notifyEachClient(const QJsonRpcMessage &message) {
+        Q_D(QJsonRpcAbstractServer);
+        for (int i = 0; i < d->clients.size(); ++i)
+            d->clients[i]->notify(message);
+    }
+};
+
+void TestBenchmark::broadcast_data()
+{
+    QTest::addColumn<int>("clients");
+    QTest::addColumn<bool>("serializeOnce");
+
+    const int counts[] = { 10, 100, 1000, 5000 };
+    for (int i = 0; i < 4; ++i) {
+        QTest::newRow(qPrintable(QString("%1-each").arg(counts[i]))) << counts[i] << false;
+        QTest::newRow(qPrintable(QString("%1-once").arg(counts[i]))) << counts[i] << true;
+    }
+}
+
+void TestBenchmark::broadcast()
+{
+    QFETCH(int, clients);
+    QFETCH(bool, serializeOnce);
+
+    BroadcastServer server;
+    server.addClients(clients);
+
+    QJsonObject event;
+    event["symbol"] = QLatin1String("QJSN");
+    event["price"] = 42.5;
+    event["history"] = QJsonArray::fromVariantList(QVariantList() << 41.0 << 41.7 << 42.1);
+    QJsonRpcMessage message = QJsonRpcMessage::createNotification("market.tick", event);
+
+    if (serializeOnce) {
+        QBENCHMARK {
+            server.notifyConnectedClients(message);
+        }
+    } else {
+        QBENCHMARK {
+            server.notifyEachClient(message);
+        }
+    }
+}
+
+// sends its requests one after the other from its own thread
+class BenchmarkClient : public QThread
+{
+public:
+    BenchmarkClient(quint16 port, int requests, QObject *parent = 0)
+        : QThread(parent), port(port), requests(requests), answered(0)
+    {}
+
+    int answeredRequests() const { return answered; }
+
+protected:
+    void run() {
+        QTcpSocket tcpSocket;
+        tcpSocket.connectToHost(QHostAddress::LocalHost, port);
+        if (!tcpSocket.waitForConnected())
+            return;
+
+        QJsonRpcSocket socket(&tcpSocket);
+        QJsonRpcMessage request =
+            QJsonRpcMessage::createRequest("service.singleParam", QString("test"));
+        for (int i = 0; i < requests; ++i) {
+            if (socket.sendMessageBlocking(request, 5000).type() == QJsonRpcMessage::Response)
+                answered++;
+        }
+    }
+
+private:
+    quint16 port;
+    int requests;
+    int answered;
+};
+
+void TestBenchmark::tcpWorkerThreads_data()
+{
+    QTest::addColumn<int>("workers");
+    QTest::addColumn<int>("loadBalancing");
+    QTest::newRow("no-workers") << 0 << int(QJsonRpcTcpServer::RoundRobin);
+    const int counts[] = { 1, 2, 4, 8 };
+    for (int i = 0; i < 4; ++i) {
+        if (counts[i] > QThread::idealThreadCount())
+            continue;
+        QTest::newRow(qPrintable(QString("%1-workers").arg(counts[i])))
+            << counts[i] << int(QJsonRpcTcpServer::RoundRobin);
+        QTest::newRow(qPrintable(QString("%1-workers-reuseport").arg(counts[i])))
+            << counts[i] << int(QJsonRpcTcpServer::ReusePort);
+    }
+}
+
+void TestBenchmark::tcpWorkerThreads()
+{
+    QFETCH(int, workers);
+    QFETCH(int, loadBalancing);
+    const int clientCount = qMax(2, QThread::idealThreadCount()) * 2;
+    const int requests = 500;
+
+    QJsonRpcTcpServer server;
+    server.setWorkerThreadCount(workers);
+    server.setLoadBalancing(static_cast<QJsonRpcTcpServer::LoadBalancing>(loadBalancing));
+    server.addService(new TestService);
+    if (!server.listen(QHostAddress::LocalHost, 5556)) {
+        QCOMPARE(loadBalancing, int(QJsonRpcTcpServer::ReusePort));
+#if QT_VERSION >= 0x050000
+        QSKIP("SO_REUSEPORT is not supported on this platform");
+#else
+        QSKIP("SO_REUSEPORT is not supported on this platform", SkipSingle);
+#endif
+    }
+
+    QBENCHMARK {
+        QList<BenchmarkClient*> clients;
+        for (int i = 0; i < clientCount; ++i) {
+            clients.append(new BenchmarkClient(5556, requests));
+            clients.last()->start();
+        }
+
+        // the service is called from this thread, keep its event loop running
+        foreach (BenchmarkClient *client, clients) {
+            while (!client->wait(1))
+                QCoreApplication::processEvents();
+            QCOMPARE(client->answeredRequests(), requests);
+        }
+        qDeleteAll(clients);
+    }
+}
+
+void TestBenchmark::requestContext_data()
+{
+    QTest::addColumn<bool>("connectPerRequest");
+    QTest::newRow("connect-per-request") << true;
+    QTest::newRow("request-context") << false;
+}
+
+/*
+ * Answering a request through a result() connection made and dropped for
+ * each request, as the provider used to, vs. through its QJsonRpcServiceRequest.
+ */
+void TestBenchmark::requestContext()
+{
+    QFETCH(bool, connectPerRequest);
+
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+    QJsonRpcSocket socket(new NullDevice(this));
+
+    QJsonRpcMessage request = QJsonRpcMessage::createRequest(
+                "service.singleParam", QString("test"));
+    if (connectPerRequest) {
+        QBENCHMARK {
+            connect(&service, SIGNAL(result(QJsonRpcMessage)), &socket, SLOT(notify(QJsonRpcMessage)));
+            service.testDispatch(request);
+            disconnect(&service, SIGNAL(result(QJsonRpcMessage)), &socket, SLOT(notify(QJsonRpcMessage)));
+        }
+    } else {
+        QBENCHMARK {
+            provider.process(&socket, request);
+        }
+    }
+}
+
+class TypedService : public QJsonRpcService
+{
+    Q_OBJECT
+    Q_CLASSINFO("serviceName", "typed")
+public:
+    TypedService(QObject *parent = 0) : QJsonRpcService(parent)
+    {
+        registerMethod("registeredParams", &TypedService::namedParams,
+                       QStringList() << "integer" << "string" << "doub");
+    }
+
+    bool testDispatch(const QJsonRpcMessage &message) {
+        return QJsonRpcService::dispatch(message);
+    }
+
+public Q_SLOTS:
+    QString namedParams(int integer, const QString &string, double doub)
+    {
+        (void) integer;
+        (void) doub;
+
+        return string;
+    }
+};
+
+void TestBenchmark::typedMethod_data()
+{
+    QTest::addColumn<QString>("method");
+    QTest::addColumn<bool>("named");
+
+    QTest::newRow("metacall-positional") << "typed.namedParams" << false;
+    QTest::newRow("metacall-named") << "typed.namedParams" << true;
+    QTest::newRow("registered-positional") << "typed.registeredParams" << false;
+    QTest::newRow("registered-named") << "typed.registeredParams" << true;
+}
+
+void TestBenchmark::typedMethod()
+{
+    QFETCH(QString, method);
+    QFETCH(bool, named);
+
+    TestServiceProvider provider;
+    TypedService service;
+    provider.addService(&service);
+
+    QJsonRpcMessage request;
+    if (named) {
+        QJsonObject params;
+        params.insert("integer", 1);
+        params.insert("string", QLatin1String("str"));
+        params.insert("doub", 1.2);
+        request = QJsonRpcMessage::createRequest(method, params);
+    } else {
+        QJsonArray params;
+        params.append(1);
+        params.append(QLatin1String("str"));
+        params.append(1.2);
+        request = QJsonRpcMessage::createRequest(method, params);
+    }
+
+    QVERIFY(service.testDispatch(request));
+    QBENCHMARK {
+        service.testDispatch(request);
+    }
+}
+
+void TestBenchmark::dispatchAllocations_data()
+{
+    QTest::addColumn<QJsonRpcMessage>("request");
+
+    QTest::newRow("int") << QJsonRpcMessage::createRequest("service.singleParam", 10);
+    QTest::newRow("string") << QJsonRpcMessage::createRequest("service.singleParam",
+                                                              QLatin1String("test"));
+
+    QJsonObject params;
+    params.insert("integer", 1);
+    params.insert("string", QLatin1String("str"));
+    params.insert("doub", 1.2);
+    QTest::newRow("named") << QJsonRpcMessage::createRequest("service.namedParams", params);
+
+    QJsonArray wide;
+    for (int i = 0; i < 9; ++i)
+        wide.append(i);
+    QTest::newRow("wide") << QJsonRpcMessage::createRequest("service.wideParams", wide);
+}
+
+void TestBenchmark::dispatchAllocations()
+{
+#ifndef QJSONRPC_COUNT_ALLOCATIONS
+#if QT_VERSION >= 0x050000
+    QSKIP("allocations are only counted with glibc");
+#else
+    QSKIP("allocations are only counted with glibc", SkipSingle);
+#endif
+#else
+    QFETCH(QJsonRpcMessage, request);
+
+    TestServiceProvider provider;
+    TestService service;
+    provider.addService(&service);
+    for (int i = 0; i < 100; ++i)
+        QVERIFY(service.testDispatch(request));
+
+    const int calls = 10000;
+#if QT_VERSION >= 0x050000
+    const int before = allocationCount.load();
+#else
+    const int before = allocationCount;
+#endif
+    for (int i = 0; i < calls; ++i)
+        service.testDispatch(request);
+#if QT_VERSION >= 0x050000
+    const int allocations = allocationCount.load() - before;
+#else
+    const int allocations = allocationCount - before;
+#endif
+
+    qDebug() << QTest::currentDataTag() << "allocations per call:" << qreal(allocations) / calls;
+    QTest::setBenchmarkResult(qreal(allocations) / calls, QTest::Events);
+#endif
+}
+
+void TestBenchmark::envelopeParsing_data()
+{
+    QTest::addColumn<bool>("lazy");
+    QTest::addColumn<bool>("readParams");
+
+    QTest::newRow("full") << false << false;
+    QTest::newRow("envelope-only") << true << false;
+    QTest::newRow("envelope-then-params") << true << true;
+}
+
+void TestBenchmark::envelopeParsing()
+{
+    QFETCH(bool, lazy);
+    QFETCH(bool, readParams);
+
+    QJsonArray params;
+    for (int i = 0; i < 1000; ++i)
+        params.append(QString("parameter %1").arg(i));
+    const QByteArray json =
+        QJsonDocument(QJsonRpcMessage::createRequest("service.forward", params).toObject()).toJson();
+
+    QBENCHMARK {
+        QJsonRpcMessage message = lazy ? QJsonRpcMessage::fromEnvelope(json) : QJsonRpcMessage(json);
+        QVERIFY(!message.method().isEmpty());
+        if (readParams)
+            QCOMPARE(message.params().toArray().size(), 1000);
+    }
+}
+
+void TestBenchmark::serialization_data()
+{
+    QTest::addColumn<bool>("serialize");
+
+    QTest::newRow("document") << false;
+    QTest::newRow("serialize") << true;
+}
+
+void TestBenchmark::serialization()
+{
+    QFETCH(bool, serialize);
+
+    QJsonObject params;
+    params.insert("name", QLatin1String("value"));
+    params.insert("count", 42);
+    const QJsonRpcMessage request = QJsonRpcMessage::createRequest("service.method", params);
+    const QJsonRpcMessage response = request.createResponse(QJsonValue(QLatin1String("ok")));
+
+    QByteArray buffer;
+    buffer.reserve(1024);
+    QBENCHMARK {
+        if (serialize) {
+            buffer.resize(0);
+            request.serialize(buffer);
+            buffer.resize(0);
+            response.serialize(buffer);
+        } else {
+#if QT_VERSION >= 0x050100 || QT_VERSION <= 0x050000
+            buffer = QJsonDocument(request.toObject()).toJson(QJsonDocument::Compact);
+            buffer = QJsonDocument(response.toObject()).toJson(QJsonDocument::Compact);
+#else
+            buffer = QJsonDocument(request.toObject()).toJson();
+            buffer = QJsonDocument(response.toObject()).toJson();
+#endif
+        }
+    }
+}
+
 QTEST_MAIN(TestBenchmark)
 #include "tst_benchmark.moc"
 